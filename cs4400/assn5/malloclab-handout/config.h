@@ -30,7 +30,9 @@
   "random-bal.rep",\
   "random2-bal.rep",\
   "binary-bal.rep",\
-  "binary2-bal.rep"
+  "binary2-bal.rep",\
+  "realloc-bal.rep",\
+  "realloc2-bal.rep"
 
 /*
  * This constant gives the estimated performance of the libc malloc
@@ -61,6 +63,11 @@
  *****************************************************************************/
 #define USE_FCYC   0   /* cycle counter w/K-best scheme (x86 & Alpha only) */
 #define USE_ITIMER 0   /* interval timer (any Unix box) */
-#define USE_GETTOD 1   /* gettimeofday (any Unix box) */
+#define USE_GETTOD 0   /* gettimeofday (any Unix box) */
+#define USE_CLOCK  1   /* invariant TSC or CLOCK_MONOTONIC_RAW, adaptive runs */
+
+/* USE_CLOCK times runs until the 95% confidence interval of the mean
+   is within this fraction of it */
+#define CLOCK_EPSILON 0.01
 
 #endif /* __CONFIG_H */
@@ -9,6 +9,8 @@
 #include "config.h"
 
 static double Mhz;  /* estimated CPU clock frequency */
+static double cv;   /* coefficient of variation of the last fsecs runs */
+static int settled = 1; /* did they meet CLOCK_EPSILON? */
 
 extern int verbose; /* -v option in mdriver.c */
 
@@ -36,6 +38,10 @@ void init_fsecs(void)
 #elif USE_GETTOD
     if (verbose)
 	printf("Measuring performance with gettimeofday().\n");
+#elif USE_CLOCK
+    const char *name = init_ftimer_clock();
+    if (verbose)
+	printf("Measuring performance with %s.\n", name);
 #endif
 }
 
@@ -51,7 +57,28 @@ double fsecs(fsecs_test_funct f, void *argp)
     return ftimer_itimer(f, argp, 10);
 #elif USE_GETTOD
     return ftimer_gettod(f, argp, 10);
+#elif USE_CLOCK
+    return ftimer_clock(f, argp, CLOCK_EPSILON, &cv, &settled);
 #endif 
 }
 
+/*
+ * fsecs_cv - Return the coefficient of variation of the runs the last
+ * fsecs timed, or 0 if the timing method does not keep them
+ */
+double fsecs_cv(void)
+{
+    return cv;
+}
+
+/*
+ * fsecs_settled - Return 0 if the last fsecs ran out of samples before
+ * its confidence interval met CLOCK_EPSILON, else 1 (also when the
+ * timing method does not check)
+ */
+int fsecs_settled(void)
+{
+    return settled;
+}
+
 
@@ -7,8 +7,16 @@
  * Function timers that estimate the running time (in seconds) of a function f.
  *    ftimer_itimer: version that uses the interval timer
  *    ftimer_gettod: version that uses gettimeofday
+ *    ftimer_clock: version that uses the invariant TSC or the raw
+ *        monotonic clock, with as many runs as it takes
  */
+#define _GNU_SOURCE /* for sched_getcpu and CPU affinity */
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <sched.h>
 #include <sys/time.h>
 #include "ftimer.h"
 
@@ -53,6 +61,140 @@ double ftimer_gettod(ftimer_test_funct f, void *argp, int n)
 }
 
 
+/*
+ * Routines for ftimer_clock
+ */
+
+/* ftimer_clock's sampling parameters */
+#define CLOCK_WARMUP       2    /* untimed runs first */
+#define CLOCK_MIN_SAMPLES  5    /* timed runs before the interval is checked */
+#define CLOCK_MAX_SAMPLES  101  /* timed runs at most */
+#define CLOCK_MAX_SECS     1.0  /* ... or until this much time was timed */
+#define CLOCK_Z            1.96 /* 95% two-sided normal quantile */
+
+static double tsc_per_sec = 0;  /* TSC rate, or 0 to use the raw clock */
+
+/* read CLOCK_MONOTONIC_RAW, in seconds */
+static double raw_secs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+#if defined(__x86_64__)
+/* read the TSC once every earlier instruction has retired */
+static uint64_t read_tsc(void)
+{
+    unsigned aux;
+    return __builtin_ia32_rdtscp(&aux);
+}
+
+/* the TSC ticks at a constant rate in every P- and C-state */
+static int tsc_invariant(void)
+{
+    unsigned a, b, c, d;
+
+    asm volatile("cpuid" : "=a" (a), "=b" (b), "=c" (c), "=d" (d) : "a" (0x80000000));
+    if (a < 0x80000007)
+	return 0;
+    asm volatile("cpuid" : "=a" (a), "=b" (b), "=c" (c), "=d" (d) : "a" (0x80000007));
+    return (d >> 8) & 1;
+}
+#endif
+
+/* 
+ * init_ftimer_clock - Pick the clock for ftimer_clock: the TSC if it
+ * is invariant, calibrated against the raw clock over 50 ms, or else
+ * the raw clock itself. Return its name.
+ */
+const char *init_ftimer_clock(void)
+{
+#if defined(__x86_64__)
+    if (tsc_invariant()) {
+	double t0 = raw_secs(), t1;
+	uint64_t c0 = read_tsc();
+	while ((t1 = raw_secs()) - t0 < 0.05)
+	    ;
+	tsc_per_sec = (read_tsc() - c0) / (t1 - t0);
+	return "the invariant TSC (rdtscp)";
+    }
+#endif
+    return "CLOCK_MONOTONIC_RAW";
+}
+
+/* seconds on ftimer_clock's clock, from an arbitrary origin */
+static double clock_secs(void)
+{
+#if defined(__x86_64__)
+    if (tsc_per_sec > 0)
+	return read_tsc() / tsc_per_sec;
+#endif
+    return raw_secs();
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* 
+ * ftimer_clock - Estimate the running time of f(argp) as the median
+ * of repeated runs, pinned to the CPU we start on. After a few warm-up
+ * runs, keep sampling until the 95% confidence interval of the mean is
+ * within epsilon of it, or the sample budget runs out. Store the
+ * samples' coefficient of variation in *cv, and in *settled whether
+ * the interval did get within epsilon.
+ */
+double ftimer_clock(ftimer_test_funct f, void *argp, double epsilon,
+		    double *cv, int *settled)
+{
+    double samples[CLOCK_MAX_SAMPLES], sum = 0, sumsq = 0, mean, sd = 0, t;
+    int i, n;
+#ifdef __linux__
+    cpu_set_t saved, one;
+    int pinned = (sched_getaffinity(0, sizeof(saved), &saved) == 0);
+
+    /* pin just this thread, and only while timing, so -T keeps its CPUs */
+    if (pinned) {
+	CPU_ZERO(&one);
+	CPU_SET(sched_getcpu(), &one);
+	pinned = (sched_setaffinity(0, sizeof(one), &one) == 0);
+    }
+#endif
+
+    for (i = 0; i < CLOCK_WARMUP; i++)
+	f(argp);
+
+    for (n = 0; n < CLOCK_MAX_SAMPLES; ) {
+	t = clock_secs();
+	f(argp);
+	t = clock_secs() - t;
+
+	samples[n++] = t;
+	sum += t;
+	sumsq += t * t;
+	mean = sum / n;
+	sd = (n > 1) ? sqrt(fmax(0, (sumsq - n * mean * mean) / (n - 1))) : 0;
+	if (n >= CLOCK_MIN_SAMPLES &&
+	    (CLOCK_Z * sd / sqrt(n) <= epsilon * mean || sum >= CLOCK_MAX_SECS))
+	    break;
+    }
+
+#ifdef __linux__
+    if (pinned)
+	sched_setaffinity(0, sizeof(saved), &saved);
+#endif
+
+    *cv = sd / (sum / n);
+    *settled = (CLOCK_Z * sd / sqrt(n) <= epsilon * (sum / n));
+    qsort(samples, n, sizeof(double), compare_doubles);
+    return (n % 2) ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+}
+
+
 /*
  * Routines for manipulating the Unix interval timer
  */
@@ -12,3 +12,13 @@ double ftimer_itimer(ftimer_test_funct f, void *argp, int n);
    Return the average of n runs */
 double ftimer_gettod(ftimer_test_funct f, void *argp, int n);
 
+/* Pick the clock ftimer_clock uses and return its name */
+const char *init_ftimer_clock(void);
+
+/* Estimate the running time of f(argp) with the TSC or the raw
+   monotonic clock: the median of as many runs as it takes for the
+   95% confidence interval of their mean to be within epsilon of it.
+   Set *cv to the runs' coefficient of variation, and *settled to 0 if
+   the sample budget ran out before the interval got that narrow */
+double ftimer_clock(ftimer_test_funct f, void *argp, double epsilon,
+		    double *cv, int *settled);
@@ -7,6 +7,7 @@
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
  */
+#define _GNU_SOURCE /* for CPU affinity */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -17,11 +18,20 @@
 #include <math.h>
 #include <inttypes.h>
 #include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/wait.h>
 
 #include "mm.h"
 #include "memlib.h"
 #include "pagemap.h"
 #include "fsecs.h"
+#include "perfctr.h"
 #include "config.h"
 
 /**********************
@@ -32,39 +42,115 @@
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define THREAD_RUNS    3 /* timed runs per threaded replay; the fastest counts */
+
+/* Latency histograms (-L) are log-linear: each power of two of timer
+   ticks is split into LAT_SUB linear buckets, so a reported percentile
+   is within 1/LAT_SUB of the true one */
+#define LAT_SUB_BITS   4
+#define LAT_SUB        (1 << LAT_SUB_BITS)
+#define LAT_BUCKETS    ((64 - LAT_SUB_BITS + 1) * LAT_SUB)
+#define LAT_CAL_SAMPLES 1001 /* back-to-back timer reads to find its overhead */
 
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((uintptr_t)(p)) % ALIGNMENT) == 0)
 
+/* The byte a checked threaded replay fills block index of thread self
+   with; thread 0 fills like eval_mm_valid */
+#define REPLAY_FILL(self, index) ((unsigned char)((index) + 67 * (self)))
+
 /****************************** 
  * The key compound data types 
  *****************************/
 
-/* Records the extent of each block's payload */
+/* Records the extent of each block's payload, as a node of a treap
+   ordered by lo */
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    unsigned prio;         /* heap priority, a hash of lo */
+    struct range_t *left;  /* lower payloads, or the next free record in the pool */
+    struct range_t *right; /* higher payloads */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
+/* Range records are carved RANGE_POOL_CHUNK at a time and recycled */
+#define RANGE_POOL_CHUNK 1024
+
+/* Characterizes a single trace operation (allocator request), packed
+   into 16 bytes since binary traces store the array as it is */
+enum {ALLOC, FREE, REALLOC, ARENA_BEGIN, ARENA_END,
+      BATCH_ALLOC, BATCH_FREE};
 typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
-    int index;                        /* index for free() to use later */
+    int index;                        /* index for free() to use later, or arena id */
     int size;                         /* byte size of alloc/realloc request */
+    union {
+	int count;                    /* number of ids from index on in a batch */
+	int arena;                    /* arena scope an alloc is served from, or -1 */
+    };
+    unsigned char type;               /* type of request */
 } traceop_t;
 
+/* 
+ * A binary trace (see write_trace) is this header followed by num_ops
+ * traceop_t records exactly as read_trace lays them out for a text
+ * trace, so it can be mapped and used in place.
+ */
+#define TRACE_MAGIC "MMTRACE1"
+typedef struct {
+    char magic[8];       /* TRACE_MAGIC, without the NUL */
+    int op_size;         /* sizeof(traceop_t) of the writer */
+    int sugg_heapsize;
+    int num_ids;
+    int num_ops;
+    int num_reqs;
+    int weight;
+    int num_arenas;
+    int unused;          /* keeps the ops 8-byte aligned */
+} trace_header_t;
+
 /* Holds the information for one trace file*/
 typedef struct {
     int sugg_heapsize;   /* suggested heap size (unused) */
     int num_ids;         /* number of alloc/realloc ids */
     int num_ops;         /* number of distinct requests */
+    int num_reqs;        /* number of malloc/free requests, counting batches per block */
     int weight;          /* weight for this trace (unused) */
     traceop_t *ops;      /* array of requests */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    int num_arenas;      /* number of arena ids */
+    mm_arena_t **arenas; /* the mm arena for each open arena scope */
+    int *block_arena;    /* the arena holding each block, or -1 */
+    void *ops_map;       /* the mapped binary trace ops points into, or NULL */
+    size_t ops_map_size; /* ... and its length */
 } trace_t;
 
+/* Latency samples of one kind of request, in timer ticks */
+enum {LAT_MALLOC, LAT_REALLOC, LAT_FREE, LAT_NUM_OPS};
+typedef struct {
+    uint64_t counts[LAT_BUCKETS]; /* samples per bucket (see lat_bucket) */
+    uint64_t total;               /* number of samples */
+    uint64_t max;                 /* largest sample */
+} lat_hist_t;
+
+/*
+ * The application side of a payload-touching replay (-W): every block
+ * is written when it is allocated, and after each request the most
+ * recently allocated live blocks are read, a fixed fraction of all
+ * live ones. Blocks allocated together are used together, so a
+ * placement policy that keeps them close gets cheaper reads.
+ */
+typedef struct {
+    int *prev, *next;      /* live blocks by id, in order of allocation */
+    int *size;             /* each block's payload size, or -1 if not live */
+    int head, tail;        /* oldest and newest live block, or -1 */
+    int live;              /* number of live blocks */
+    uint64_t alloc_ticks;  /* timer ticks spent in mm requests */
+    uint64_t touch_ticks;  /* ... and in writing and reading payloads */
+    uint64_t bytes;        /* payload bytes written and read */
+    unsigned sink;         /* sum of what was read */
+} touch_t;
+
 /* 
  * Holds the params to the xxx_speed functions, which are timed by fcyc. 
  * This struct is necessary because fcyc accepts only a pointer array
@@ -73,20 +159,79 @@ typedef struct {
 typedef struct {
     trace_t *trace;  
     range_t *ranges;
+    lat_hist_t *lat; /* if set, eval_mm_speed times each request into lat[LAT_NUM_OPS] */
+    touch_t *touch;  /* if set, eval_mm_speed touches payloads after each request */
 } speed_t;
 
+/*
+ * A block one replay thread freed and handed to another to free (-X)
+ */
+typedef struct {
+    int op;                     /* the request that freed it */
+    int count;                  /* blocks freed together from here on: 1 for
+                                   a FREE, the whole batch for a BATCH_FREE */
+    int size;                   /* payload bytes filled when checking */
+    unsigned char fill;         /* ... and the byte they hold */
+} handoff_t;
+
+/*
+ * Carries the handed-off blocks from one replay thread to the next.
+ * One producer and one consumer; it holds every free in the trace, so
+ * the producer never waits for room.
+ */
+typedef struct {
+    void **blocks;              /* the blocks, in the order they were freed */
+    handoff_t *slots;           /* ... and what is known about each */
+    int tail;                   /* slots the producer has filled */
+    int head;                   /* slots the consumer has freed */
+    int done;                   /* the producer has finished its replay */
+} mailbox_t;
+
+/*
+ * Holds the params to replay_thread. Every thread replays the whole
+ * trace, with its own array of block pointers.
+ */
+typedef struct {
+    trace_t *trace;
+    int self;                   /* this thread's number, to vary the fill bytes */
+    char **blocks;              /* this thread's ptrs returned by malloc/realloc */
+    int *sizes;                 /* ... and their sizes */
+    mailbox_t *out;             /* if set, hand the blocks this thread frees on here */
+    mailbox_t *in;              /* if set, free the blocks handed on through here */
+    int check;                  /* if set, check payloads like eval_mm_valid */
+    int err_op;                 /* the first request that failed a check, or -1 */
+    char *err_msg;              /* ... and why */
+    pthread_barrier_t *start;   /* lets all threads start together */
+    struct timespec t0, t1;     /* when this thread started and finished */
+} replay_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* defined for both libc malloc and student malloc package (mm.c) */
     double ops;      /* number of ops (malloc/free/realloc) in the trace */
     int valid;       /* was the trace processed correctly by the allocator? */
     double secs;     /* number of secs needed to run the trace */
+    double secs_cv;  /* coefficient of variation of the timed runs behind secs */
+    int secs_settled; /* did those runs meet CLOCK_EPSILON? */
 
     /* defined only for the student malloc package */
     double util;     /* overall space utilization for this trace (always 0 for libc) */
 
     double inst_util;     /* instanteous space utilization for this trace (always 0 for libc) */
 
+    size_t peak_heap;     /* largest heap the package used for this trace (0 for libc) */
+
+    lat_hist_t *lat;      /* per-request latency histograms, with -L only */
+
+    double alloc_secs;    /* time in mm requests in the payload-touching run (-W only) */
+    double touch_secs;    /* ... and in the trace's own payload writes and reads */
+    double touch_bytes;   /* ... which covered this many bytes */
+
+    int counted;          /* perf holds hardware counts of one run (-p only) */
+    double perf[PERFCTR_NUM]; /* each counter over one run, or -1 if unavailable */
+
+    const char *policy;   /* placement policy that produced these numbers */
+
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
 
@@ -95,7 +240,13 @@ typedef struct {
  *******************/
 int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
+static int use_arenas = 1; /* serve allocs inside arena scopes from mm arenas */
+static int use_batches = 1; /* serve batch requests with mm_malloc_batch/mm_free_batch */
+static double touch_frac = -1; /* with -W, share of live blocks read per request */
+static volatile unsigned touch_sink; /* where -W reads end up, so they are not dropped */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
+static double lat_ticks_per_ns = 1; /* latency timer rate, set by lat_calibrate */
+static uint64_t lat_overhead = 0;   /* ticks one pair of timer reads costs */
 
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
@@ -118,6 +269,8 @@ static void clear_ranges(range_t **ranges);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
+static trace_t *map_trace(trace_t *trace, char *path);
+static void write_trace(trace_t *trace, char *path);
 static void free_trace(trace_t *trace);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
@@ -127,8 +280,40 @@ static void eval_libc_speed(void *ptr);
 /* Routines for evaluating correctnes, space utilization, and speed 
    of the student's malloc package in mm.c */
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, double *inst_ratio);
+static double eval_mm_util(trace_t *trace, double *inst_ratio, size_t *peak_heap);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_trace(char *tracefile, int tracenum, stats_t *stats, range_t **ranges,
+			  int latency, int counters, int timing);
+
+/* Routines for evaluating traces in parallel worker processes (-j) */
+static void eval_mm_parallel(char **tracefiles, int n, stats_t *stats, int jobs,
+			     int serialize, int latency, int counters);
+static void eval_mm_worker(char *tracefile, int tracenum, int cpu, int fd,
+			   int latency, int counters, char *timing_path);
+
+/* Routines for measuring how the mm package scales with threads */
+static void replay_fail(replay_t *params, int op, char *msg);
+static int replay_check(replay_t *params, int op, char *p, int size, unsigned char fill);
+static void replay_fill(replay_t *params, int op, char *p, int size, unsigned char fill);
+static void replay_handoff(replay_t *params, int op, int index, int count);
+static void replay_drain(replay_t *params, int wait);
+static void *replay_thread(void *ptr);
+static double eval_mm_threads(trace_t *trace, int tracenum, int nthreads, int handoff);
+
+/* Routines for per-request latency histograms */
+static inline uint64_t lat_ticks(void);
+static void lat_calibrate(void);
+static void lat_record(lat_hist_t *lat, trace_t *trace, traceop_t *op, uint64_t ticks);
+static uint64_t lat_percentile(lat_hist_t *hist, double q);
+static void printlatency(int n, stats_t *stats);
+
+/* Prints the hardware counters from -p */
+static void printperf(int n, stats_t *stats, char *name);
+
+/* Routines for the payload-touching replay (-W) */
+static void touch_op(touch_t *touch, trace_t *trace, traceop_t *op, uint64_t ticks);
+static void eval_mm_touch(speed_t *speed_params, stats_t *stats);
+static void printtouch(int n, stats_t *stats);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
@@ -153,7 +338,18 @@ int main(int argc, char **argv)
     speed_t speed_params;      /* input parameters to the xx_speed routines */ 
 
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
+    int policy;          /* mm placement policy (set by -P) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int max_threads = 0; /* If set, also replay in 1..max_threads threads (-T) */
+    int handoff = 0;     /* If set, -T threads free each other's blocks (-X) */
+    int huge_pages = 0;  /* If set, also time huge-page backed heaps (-H) */
+    int reserve = 0;     /* If set, commit the mm heap in one reserved range (-R) */
+    int cache_kb = -1;   /* If set, memlib page cache high-water mark in KB (-C) */
+    char *convert = NULL;/* If set, write the -f trace here in binary and exit (-c) */
+    int latency = 0;     /* If set, also histogram each request's latency (-L) */
+    int counters = 0;    /* If set, also read hardware counters per trace (-p) */
+    int jobs = 0;        /* If set, evaluate this many traces at once (-j or -J) */
+    int serialize = 1;   /* If set, -j workers take turns at timing (cleared by -J) */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, inst_util, avg_mm_inst_util, avg_mm_util, avg_mm_throughput;
@@ -163,7 +359,7 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:c:C:j:J:P:T:W:hvVgalpABHLRX")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -183,6 +379,70 @@ int main(int argc, char **argv)
 	    if (tracedir[strlen(tracedir)-1] != '/') 
 		strcat(tracedir, "/"); /* path always ends with "/" */
 	    break;
+	case 'P': /* Placement policy for mm malloc */
+	    for (policy = 0; policy < MM_NUM_FIT_POLICIES; policy++)
+		if (strcmp(optarg, mm_fit_policy_name(policy)) == 0)
+		    break;
+	    if (policy == MM_NUM_FIT_POLICIES) {
+		usage();
+		exit(1);
+	    }
+	    mm_set_fit_policy(policy);
+	    break;
+	case 'T': /* Multi-threaded replay with up to this many threads */
+	    max_threads = atoi(optarg);
+	    if (max_threads < 1) {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case 'X': /* -T threads free the blocks the next thread allocated */
+	    handoff = 1;
+	    break;
+	case 'j': /* Evaluate traces in this many worker processes */
+	case 'J': /* ... and let their timed runs overlap too */
+	    jobs = atoi(optarg);
+	    serialize = (c == 'j');
+	    if (jobs < 1) {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case 'W': /* Touch payloads, reading this % of live blocks per request */
+	    touch_frac = atof(optarg) / 100;
+	    if (touch_frac < 0 || touch_frac > 1) {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case 'A': /* Treat arena scopes in traces as plain malloc/free */
+	    use_arenas = 0;
+	    break;
+	case 'B': /* Split batch requests in traces into single malloc/free */
+	    use_batches = 0;
+	    break;
+	case 'H': /* Compare throughput with huge-page backed heaps */
+	    huge_pages = 1;
+	    break;
+	case 'L': /* Histogram the latency of each mm request */
+	    latency = 1;
+	    break;
+	case 'p': /* Read hardware performance counters around each trace */
+	    counters = 1;
+	    break;
+	case 'R': /* Reserve address space once and commit pages on demand */
+	    reserve = 1;
+	    break;
+	case 'c': /* Convert a text trace to the binary format */
+	    convert = optarg;
+	    break;
+	case 'C': /* High-water mark of memlib's page cache */
+	    cache_kb = atoi(optarg);
+	    if (cache_kb < 0) {
+		usage();
+		exit(1);
+	    }
+	    break;
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
@@ -201,6 +461,20 @@ int main(int argc, char **argv)
         }
     }
 	
+    /*
+     * With -c, only convert the -f trace, unaltered by -A and -B
+     */
+    if (convert) {
+	if (num_tracefiles != 1 || !use_arenas || !use_batches) {
+	    usage();
+	    exit(1);
+	}
+	trace = read_trace(tracedir, tracefiles[0]);
+	write_trace(trace, convert);
+	free_trace(trace);
+	exit(0);
+    }
+
     /* 
      * If no -f command line arg, then use the entire set of tracefiles 
      * defined in default_traces[]
@@ -213,6 +487,12 @@ int main(int argc, char **argv)
 
     /* Initialize the timing package */
     init_fsecs();
+    speed_params.lat = NULL;
+    speed_params.touch = NULL;
+    if (latency || touch_frac >= 0)
+	lat_calibrate();
+    if (counters && init_perfctr(1) == 0)
+	counters = 0; /* nothing to report, so run as without -p */
 
     /*
      * Optionally run and evaluate the libc malloc package 
@@ -229,7 +509,8 @@ int main(int argc, char **argv)
 	/* Evaluate the libc malloc package using the K-best scheme */
 	for (i=0; i < num_tracefiles; i++) {
 	    trace = read_trace(tracedir, tracefiles[i]);
-	    libc_stats[i].ops = trace->num_ops;
+	    libc_stats[i].ops = trace->num_reqs;
+	    libc_stats[i].policy = "libc";
 	    if (verbose > 1)
 		printf("Checking libc malloc for correctness, ");
 	    libc_stats[i].valid = eval_libc_valid(trace, i);
@@ -238,6 +519,12 @@ int main(int argc, char **argv)
 		if (verbose > 1)
 		    printf("and performance.\n");
 		libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
+		libc_stats[i].secs_cv = fsecs_cv();
+		libc_stats[i].secs_settled = fsecs_settled();
+		if (counters) {
+		    perfctr_count(eval_libc_speed, &speed_params, libc_stats[i].perf);
+		    libc_stats[i].counted = 1;
+		}
 	    }
 	    free_trace(trace);
 	}
@@ -247,6 +534,8 @@ int main(int argc, char **argv)
 	    printf("\nResults for libc malloc:\n");
 	    printresults(num_tracefiles, libc_stats);
 	}
+	if (counters)
+	    printperf(num_tracefiles, libc_stats, "libc malloc");
     }
 
     /*
@@ -262,26 +551,19 @@ int main(int argc, char **argv)
     
     /* Initialize the simulated memory system in memlib.c */
     mem_init(); 
-
-    /* Evaluate student's mm malloc package using the K-best scheme */
-    for (i=0; i < num_tracefiles; i++) {
-	trace = read_trace(tracedir, tracefiles[i]);
-	mm_stats[i].ops = trace->num_ops;
-	if (verbose > 1)
-	    printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-	if (mm_stats[i].valid) {
-	    if (verbose > 1)
-		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges, &mm_stats[i].inst_util);
-	    speed_params.trace = trace;
-	    speed_params.ranges = ranges;
-	    if (verbose > 1)
-		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
-	}
-	free_trace(trace);
-    }
+    mem_set_reserve(reserve);
+    if (cache_kb >= 0)
+	mem_set_cache((size_t)cache_kb * 1024);
+
+    /* Evaluate student's mm malloc package, one trace at a time or
+       in -j worker processes */
+    if (jobs > 0)
+	eval_mm_parallel(tracefiles, num_tracefiles, mm_stats, jobs,
+			 serialize, latency, counters);
+    else
+	for (i=0; i < num_tracefiles; i++)
+	    eval_mm_trace(tracefiles[i], i, &mm_stats[i], &ranges,
+			  latency, counters, -1);
 
     /* Display the mm results in a compact table */
     if (verbose) {
@@ -289,6 +571,86 @@ int main(int argc, char **argv)
 	printresults(num_tracefiles, mm_stats);
 	printf("\n");
     }
+    if (counters) {
+	printperf(num_tracefiles, mm_stats, "mm malloc");
+	printf("\n");
+    }
+    if (latency) {
+	printlatency(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (touch_frac >= 0) {
+	printtouch(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /*
+     * Optionally measure throughput with 1..max_threads threads, each
+     * replaying its own copy of the trace at the same time
+     */
+    if (max_threads > 0) {
+	double secs1, kops, kops1 = 0;
+	int n;
+
+	printf("Threaded replay for mm malloc%s:\n",
+	       handoff ? ", each thread freeing the next one's blocks" : "");
+	printf("%5s%8s%10s%8s%8s\n", "trace", "threads", "secs", "Kops", "speedup");
+	for (i=0; i < num_tracefiles; i++) {
+	    if (!mm_stats[i].valid)
+		continue;
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    for (n = 1; n <= max_threads; n++) {
+		secs1 = eval_mm_threads(trace, i, n, handoff);
+		if (secs1 < 0) {
+		    printf("%2d%11d%10s%8s%8s\n", i, n, "-", "-", "-");
+		    break;
+		}
+		kops = (n * trace->num_reqs / 1e3) / secs1;
+		if (n == 1)
+		    kops1 = kops;
+		printf("%2d%11d%10.6f%8.0f%8.2f\n", i, n, secs1, kops, kops / kops1);
+	    }
+	    free_trace(trace);
+	}
+	printf("\n");
+    }
+
+    /*
+     * Optionally rerun the traces whose heap spans at least one huge
+     * page with memlib carving the heap out of huge-page regions, and
+     * out of the same regions on base pages, so that the speedup is
+     * down to page size alone and not to the carving saving mmaps
+     */
+    if (huge_pages) {
+	double small_secs, huge_secs;
+	int saved_reserve = mem_reserve(); /* huge regions turn -R off */
+
+	printf("Huge-page regions for mm malloc (speedup of huge over base-page regions):\n");
+	printf("%5s%10s%12s%10s%10s%8s\n", "trace", "heap(KB)", "default", "regions", "huge", "speedup");
+	mem_set_huge(MEM_HUGE_ON);
+	for (i=0; i < num_tracefiles; i++) {
+	    if (!mm_stats[i].valid || mm_stats[i].peak_heap < mem_hugepagesize())
+		continue;
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    if (eval_mm_valid(trace, i, &ranges)) {
+		speed_params.trace = trace;
+		speed_params.ranges = ranges;
+		huge_secs = fsecs(eval_mm_speed, &speed_params);
+		mem_set_huge(MEM_HUGE_SMALL);
+		small_secs = fsecs(eval_mm_speed, &speed_params);
+		mem_set_huge(MEM_HUGE_ON);
+		printf("%2d%13zu%12.0f%10.0f%10.0f%8.2f\n", i, mm_stats[i].peak_heap / 1024,
+		       mm_stats[i].ops / 1e3 / mm_stats[i].secs,
+		       mm_stats[i].ops / 1e3 / small_secs,
+		       mm_stats[i].ops / 1e3 / huge_secs,
+		       small_secs / huge_secs);
+	    }
+	    free_trace(trace);
+	}
+	mem_set_huge(MEM_HUGE_OFF);
+	mem_set_reserve(saved_reserve);
+	printf("\n");
+    }
 
     /* 
      * Accumulate the aggregate statistics for the student's mm package 
@@ -348,11 +710,92 @@ int main(int argc, char **argv)
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps 
+ * The following routines manipulate the range tree, which keeps 
  * track of the extent of every allocated block payload. We use the 
- * range list to detect any overlapping allocated blocks.
+ * range tree to detect any overlapping allocated blocks. It is a
+ * treap ordered by payload address, so a new payload only has to be
+ * checked against its predecessor and successor.
  ****************************************************************/
 
+static range_t *range_pool = NULL; /* free range records */
+
+/* range_alloc - take a record from the pool, refilling it if empty */
+static range_t *range_alloc(void)
+{
+    range_t *p;
+    int i;
+
+    if (range_pool == NULL) {
+	if ((p = (range_t *)malloc(RANGE_POOL_CHUNK * sizeof(range_t))) == NULL)
+	    unix_error("malloc error in range_alloc");
+	for (i = 0; i < RANGE_POOL_CHUNK; i++) {
+	    p[i].left = range_pool;
+	    range_pool = &p[i];
+	}
+    }
+    p = range_pool;
+    range_pool = p->left;
+    return p;
+}
+
+static void range_free(range_t *p)
+{
+    p->left = range_pool;
+    range_pool = p;
+}
+
+/* range_prio - scramble the address bits into a treap priority */
+static unsigned range_prio(char *lo)
+{
+    uint64_t x = (uint64_t)(uintptr_t)lo;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return (unsigned)x;
+}
+
+/* range_insert - insert node n into the treap at root; returns the new root */
+static range_t *range_insert(range_t *root, range_t *n)
+{
+    range_t *c;
+
+    if (root == NULL)
+	return n;
+    if (n->lo < root->lo) {
+	root->left = range_insert(root->left, n);
+	if (root->left->prio > root->prio) { /* rotate right */
+	    c = root->left;
+	    root->left = c->right;
+	    c->right = root;
+	    return c;
+	}
+    } else {
+	root->right = range_insert(root->right, n);
+	if (root->right->prio > root->prio) { /* rotate left */
+	    c = root->right;
+	    root->right = c->left;
+	    c->left = root;
+	    return c;
+	}
+    }
+    return root;
+}
+
+/* range_join - merge two treaps, all of l below all of r */
+static range_t *range_join(range_t *l, range_t *r)
+{
+    if (l == NULL)
+	return r;
+    if (r == NULL)
+	return l;
+    if (l->prio > r->prio) {
+	l->right = range_join(l->right, r);
+	return l;
+    }
+    r->left = range_join(l, r->left);
+    return r;
+}
+
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of 
@@ -363,9 +806,8 @@ static int add_range(range_t **ranges, char *lo, int size,
 		     int tracenum, int opnum)
 {
     char *hi = lo + size - 1;
-    range_t *p;
+    range_t *p, *pred = NULL, *succ = NULL;
     char msg[MAXLINE];
-    size_t page_size = mem_pagesize(), i;
 
     assert(size > 0);
 
@@ -377,76 +819,81 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
     
-    /* The payload must lie on a mapped page */
-    for (i = 0; i < size; i += page_size) {
-      if (!pagemap_is_mapped(lo+i)) {
-	sprintf(msg, "Payload (%p:%p) includes an unmapped page",
-		lo, hi);
-	malloc_error(tracenum, opnum, msg);
-        return 0;
-      }
-    }
-    if (!pagemap_is_mapped(lo+size-1)) {
-      sprintf(msg, "Payload (%p:%p) ends at an unmapped page",
-              lo, hi);
+    /* The payload must lie on mapped pages */
+    if (!pagemap_is_mapped_range(lo, size)) {
+      sprintf(msg, "Payload (%p:%p) includes an unmapped page",
+	      lo, hi);
       malloc_error(tracenum, opnum, msg);
       return 0;
     }
 
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-		    lo, hi, p->lo, p->hi);
-	    malloc_error(tracenum, opnum, msg);
-	    return 0;
-        }
+    /* The payload must not overlap any other payloads: since those do
+     * not overlap each other, it is enough to check the payloads just
+     * below and just above it */
+    for (p = *ranges;  p != NULL; ) {
+	if (p->lo <= lo) {
+	    pred = p;
+	    p = p->right;
+	} else {
+	    succ = p;
+	    p = p->left;
+	}
+    }
+    if (pred != NULL && pred->hi >= lo)
+	p = pred;
+    else if (succ != NULL && succ->lo <= hi)
+	p = succ;
+    else
+	p = NULL;
+    if (p != NULL) {
+	sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+		lo, hi, p->lo, p->hi);
+	malloc_error(tracenum, opnum, msg);
+	return 0;
     }
 
     /* 
      * Everything looks OK, so remember the extent of this block 
-     * by creating a range struct and adding it the range list.
+     * by creating a range struct and adding it the range tree.
      */
-    if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
-	unix_error("malloc error in add_range");
-    p->next = *ranges;
+    p = range_alloc();
     p->lo = lo;
     p->hi = hi;
-    *ranges = p;
+    p->prio = range_prio(lo);
+    p->left = p->right = NULL;
+    *ranges = range_insert(*ranges, p);
     return 1;
 }
 
 /* 
- * remove_range - Free the range record of block whose payload starts at lo 
+ * remove_range - Free the range record of the block whose payload starts at lo 
  */
 static void remove_range(range_t **ranges, char *lo)
 {
     range_t *p;
-    range_t **prevpp = ranges;
 
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-	    *prevpp = p->next;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
+    while ((p = *ranges) != NULL) {
+	if (p->lo == lo) {
+	    *ranges = range_join(p->left, p->right);
+	    range_free(p);
+	    break;
+	}
+	ranges = (lo < p->lo) ? &p->left : &p->right;
     }
 }
 
 /*
- * clear_ranges - free all of the range records for a trace 
+ * clear_ranges - return all of the range records for a trace to the pool
  */
 static void clear_ranges(range_t **ranges)
 {
-    range_t *p;
-    range_t *pnext;
+    range_t *p = *ranges;
 
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
-    }
+    if (p == NULL)
+	return;
+    clear_ranges(&p->left);
+    clear_ranges(&p->right);
+    range_free(p);
     *ranges = NULL;
 }
 
@@ -464,9 +911,13 @@ static trace_t *read_trace(char *tracedir, char *filename)
     trace_t *trace;
     char type[MAXLINE];
     char path[MAXLINE];
-    unsigned index, size;
+    unsigned index, size, count;
     unsigned max_index = 0;
     unsigned op_index;
+    int num_lines = 0;        /* request lines read */
+    unsigned max_ops;         /* room in trace->ops, grown when -B splits batches */
+    int *scopes;              /* stack of open arena scopes */
+    int depth = 0;
 
     if (verbose > 1)
 	printf("Reading tracefile: %s\n", filename);
@@ -482,14 +933,25 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	sprintf(msg, "Could not open %s in read_trace", path);
 	unix_error(msg);
     }
+
+    /* A binary trace is mapped instead of parsed */
+    if (fread(type, 1, strlen(TRACE_MAGIC), tracefile) == strlen(TRACE_MAGIC)
+	&& memcmp(type, TRACE_MAGIC, strlen(TRACE_MAGIC)) == 0) {
+	fclose(tracefile);
+	return map_trace(trace, path);
+    }
+    rewind(tracefile);
+    trace->ops_map = NULL;
+
     fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
     fscanf(tracefile, "%d", &(trace->num_ids));     
     fscanf(tracefile, "%d", &(trace->num_ops));     
     fscanf(tracefile, "%d", &(trace->weight));        /* not used */
     
     /* We'll store each request line in the trace in this array */
+    max_ops = trace->num_ops;
     if ((trace->ops = 
-	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
+	 (traceop_t *)calloc(max_ops, sizeof(traceop_t))) == NULL)
 	unix_error("malloc 2 failed in read_trace");
 
     /* We'll keep an array of pointers to the allocated blocks here... */
@@ -501,17 +963,30 @@ static trace_t *read_trace(char *tracedir, char *filename)
     if ((trace->block_sizes = 
 	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
 	unix_error("malloc 4 failed in read_trace");
+
+    /* ... and the arena, if any, that each block came from */
+    if ((trace->block_arena = 
+	 (int *)malloc(trace->num_ids * sizeof(int))) == NULL)
+	unix_error("malloc 5 failed in read_trace");
+    if ((scopes = (int *)malloc(trace->num_ops * sizeof(int))) == NULL)
+	unix_error("malloc 6 failed in read_trace");
+    trace->num_arenas = 0;
     
     /* read every request line in the trace file */
     index = 0;
     op_index = 0;
+    trace->num_reqs = 0;
     while (fscanf(tracefile, "%s", type) != EOF) {
+	num_lines++;
+	trace->num_reqs++;
 	switch(type[0]) {
 	case 'a':
 	    fscanf(tracefile, "%u %u", &index, &size);
 	    trace->ops[op_index].type = ALLOC;
 	    trace->ops[op_index].index = index;
 	    trace->ops[op_index].size = size;
+	    trace->ops[op_index].arena = 
+		(use_arenas && depth > 0) ? scopes[depth-1] : -1;
 	    max_index = (index > max_index) ? index : max_index;
 	    break;
 	case 'r':
@@ -526,6 +1001,58 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	    trace->ops[op_index].type = FREE;
 	    trace->ops[op_index].index = index;
 	    break;
+	case 'b': /* allocs up to the matching 'e' come from arena <index> */
+	case 'e':
+	    fscanf(tracefile, "%u", &index);
+	    if (type[0] == 'b') {
+		scopes[depth++] = index;
+	    } else if (depth == 0 || scopes[--depth] != (int)index) {
+		printf("Unmatched arena scope end (%u) in tracefile %s\n", 
+		       index, path);
+		exit(1);
+	    }
+	    if (!use_arenas) {
+		trace->num_reqs--;
+		continue;
+	    }
+	    trace->ops[op_index].type = (type[0] == 'b') ? ARENA_BEGIN : ARENA_END;
+	    trace->ops[op_index].index = index;
+	    if ((int)index >= trace->num_arenas)
+		trace->num_arenas = index + 1;
+	    trace->num_reqs--;
+	    break;
+	case 'A': /* ids index..index+count-1 each get size bytes */
+	case 'F': /* ids index..index+count-1 are freed */
+	    if (type[0] == 'A')
+		fscanf(tracefile, "%u %u %u", &index, &count, &size);
+	    else
+		fscanf(tracefile, "%u %u", &index, &count);
+	    if (count == 0) {
+		printf("Empty batch (%u) in tracefile %s\n", index, path);
+		exit(1);
+	    }
+	    if (type[0] == 'A' && index + count - 1 > max_index)
+		max_index = index + count - 1;
+	    trace->num_reqs += count - 1;
+	    if (!use_batches) {
+		/* Replay the batch as count single requests */
+		max_ops += count - 1;
+		if ((trace->ops = (traceop_t *)
+		     realloc(trace->ops, max_ops * sizeof(traceop_t))) == NULL)
+		    unix_error("realloc failed in read_trace");
+		for (; count > 0; count--, index++, op_index++) {
+		    trace->ops[op_index].type = (type[0] == 'A') ? ALLOC : FREE;
+		    trace->ops[op_index].index = index;
+		    trace->ops[op_index].size = size;
+		    trace->ops[op_index].arena = -1;
+		}
+		continue;
+	    }
+	    trace->ops[op_index].type = (type[0] == 'A') ? BATCH_ALLOC : BATCH_FREE;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].count = count;
+	    trace->ops[op_index].size = size;
+	    break;
 	default:
 	    printf("Bogus type character (%c) in tracefile %s\n", 
 		   type[0], path);
@@ -535,21 +1062,155 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	
     }
     fclose(tracefile);
-    assert(max_index == trace->num_ids - 1);
-    assert(trace->num_ops == op_index);
+    free(scopes);
+    assert(depth == 0);
+    assert((int)max_index == trace->num_ids - 1);
+    assert(trace->num_ops == num_lines);
+    trace->num_ops = op_index;
+
+    if ((trace->arenas = (mm_arena_t **)
+	 calloc(trace->num_arenas + 1, sizeof(mm_arena_t *))) == NULL)
+	unix_error("malloc 7 failed in read_trace");
     
     return trace;
 }
 
 /*
- * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
+ * map_trace - Read the binary trace at path into trace by mapping it,
+ *     so trace->ops points straight into the file. Only -A and -B,
+ *     which change the requests, make read_trace's rewritten copy.
+ */
+static trace_t *map_trace(trace_t *trace, char *path)
+{
+    int fd, i, j, n;
+    struct stat st;
+    trace_header_t *hdr;
+    traceop_t *ops;
+
+    if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+	sprintf(msg, "Could not open %s in map_trace", path);
+	unix_error(msg);
+    }
+    hdr = (trace_header_t *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (hdr == MAP_FAILED)
+	unix_error("mmap failed in map_trace");
+    close(fd);
+    if ((size_t)st.st_size < sizeof(trace_header_t)
+	|| hdr->op_size != sizeof(traceop_t)
+	|| (size_t)st.st_size != sizeof(trace_header_t) 
+	                         + (size_t)hdr->num_ops * sizeof(traceop_t)) {
+	printf("Bad binary tracefile %s\n", path);
+	exit(1);
+    }
+
+    trace->sugg_heapsize = hdr->sugg_heapsize;
+    trace->num_ids = hdr->num_ids;
+    trace->num_ops = hdr->num_ops;
+    trace->num_reqs = hdr->num_reqs;
+    trace->weight = hdr->weight;
+    trace->num_arenas = hdr->num_arenas;
+    ops = (traceop_t *)(hdr + 1);
+
+    if (use_arenas && use_batches) {
+	trace->ops = ops;
+	trace->ops_map = hdr;
+	trace->ops_map_size = st.st_size;
+    } else {
+	/* Drop arena scopes (-A) and split batches (-B) as read_trace does */
+	for (i = n = 0; i < hdr->num_ops; i++) {
+	    if (ops[i].type == ARENA_BEGIN || ops[i].type == ARENA_END)
+		n += use_arenas;
+	    else if (ops[i].type == BATCH_ALLOC || ops[i].type == BATCH_FREE)
+		n += use_batches ? 1 : ops[i].count;
+	    else
+		n++;
+	}
+	if ((trace->ops = (traceop_t *)malloc(n * sizeof(traceop_t))) == NULL)
+	    unix_error("malloc 2 failed in map_trace");
+	for (i = n = 0; i < hdr->num_ops; i++) {
+	    if (!use_arenas && (ops[i].type == ARENA_BEGIN || ops[i].type == ARENA_END))
+		continue;
+	    if (!use_batches && (ops[i].type == BATCH_ALLOC || ops[i].type == BATCH_FREE)) {
+		for (j = 0; j < ops[i].count; j++, n++) {
+		    trace->ops[n].type = (ops[i].type == BATCH_ALLOC) ? ALLOC : FREE;
+		    trace->ops[n].index = ops[i].index + j;
+		    trace->ops[n].size = ops[i].size;
+		    trace->ops[n].arena = -1;
+		}
+		continue;
+	    }
+	    trace->ops[n] = ops[i];
+	    if (!use_arenas && ops[i].type == ALLOC)
+		trace->ops[n].arena = -1;
+	    n++;
+	}
+	trace->num_ops = n;
+	if (!use_arenas)
+	    trace->num_arenas = 0;
+	trace->ops_map = NULL;
+	munmap(hdr, st.st_size);
+    }
+
+    if ((trace->blocks = 
+	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	unix_error("malloc 3 failed in map_trace");
+    if ((trace->block_sizes = 
+	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+	unix_error("malloc 4 failed in map_trace");
+    if ((trace->block_arena = 
+	 (int *)malloc(trace->num_ids * sizeof(int))) == NULL)
+	unix_error("malloc 5 failed in map_trace");
+    if ((trace->arenas = (mm_arena_t **)
+	 calloc(trace->num_arenas + 1, sizeof(mm_arena_t *))) == NULL)
+	unix_error("malloc 7 failed in map_trace");
+
+    return trace;
+}
+
+/*
+ * write_trace - Save trace, as read_trace laid it out, as a binary
+ *     trace at path for map_trace
+ */
+static void write_trace(trace_t *trace, char *path)
+{
+    trace_header_t hdr;
+    FILE *f;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+    hdr.op_size = sizeof(traceop_t);
+    hdr.sugg_heapsize = trace->sugg_heapsize;
+    hdr.num_ids = trace->num_ids;
+    hdr.num_ops = trace->num_ops;
+    hdr.num_reqs = trace->num_reqs;
+    hdr.weight = trace->weight;
+    hdr.num_arenas = trace->num_arenas;
+
+    if ((f = fopen(path, "w")) == NULL
+	|| fwrite(&hdr, sizeof(hdr), 1, f) != 1
+	|| fwrite(trace->ops, sizeof(traceop_t), trace->num_ops, f) 
+	   != (size_t)trace->num_ops
+	|| fclose(f) != 0) {
+	sprintf(msg, "Could not write %s in write_trace", path);
+	unix_error(msg);
+    }
+}
+
+/*
+ * free_trace - Free the trace record and the five arrays it points
+ *              to, all of which were allocated in read_trace(); the
+ *              ops of a mapped binary trace are unmapped instead.
  */
 void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
+    if (trace->ops_map)
+	munmap(trace->ops_map, trace->ops_map_size);
+    else
+	free(trace->ops);     /* free the five arrays... */
     free(trace->blocks);      
     free(trace->block_sizes);
+    free(trace->arenas);
+    free(trace->block_arena);
     free(trace);              /* and the trace record itself... */
 }
 
@@ -563,15 +1224,19 @@ void free_trace(trace_t *trace)
  */
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) 
 {
-    int i;
+    int i, j;
     int index;
     int size;
+    int oldsize;
+    int arena;
     char *newp;
     char *oldp;
     char *p;
     
     /* Reset the heap and free any records in the range list */
     clear_ranges(ranges);
+    for (i = 0; i < trace->num_ids; i++)
+	trace->block_arena[i] = -1;
 
     /* Call the mm package's init function */
     if (mm_init() < 0) {
@@ -588,8 +1253,13 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 
         case ALLOC: /* mm_malloc */
 
-	    /* Call the student's malloc */
-	    if ((p = mm_malloc(size)) == NULL) {
+	    /* Call the student's malloc, or allocate from the scope's arena */
+	    arena = trace->ops[i].arena;
+	    if (arena >= 0)
+		p = mm_arena_alloc(trace->arenas[arena], size);
+	    else
+		p = mm_malloc(size);
+	    if (p == NULL) {
 		malloc_error(tracenum, i, "mm_malloc failed.");
 		return 0;
 	    }
@@ -612,14 +1282,21 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    /* Remember region */
 	    trace->blocks[index] = p;
 	    trace->block_sizes[index] = size;
+	    trace->block_arena[index] = arena;
 	    break;
 
-        case REALLOC: /* mm_malloc + mm_free */
+        case REALLOC: /* mm_realloc */
 	    
-	    /* Call the student's realloc */
+	    /* Call the student's realloc (an arena block stays in its arena) */
 	    oldp = trace->blocks[index];
-	    if ((newp = mm_malloc(size)) == NULL) {
-		malloc_error(tracenum, i, "mm_malloc failed.");
+	    arena = trace->block_arena[index];
+	    if (arena >= 0)
+		newp = mm_arena_realloc(trace->arenas[arena], oldp, 
+					trace->block_sizes[index], size);
+	    else
+		newp = mm_realloc(oldp, size);
+	    if (newp == NULL) {
+		malloc_error(tracenum, i, "mm_realloc failed.");
 		return 0;
 	    }
 
@@ -630,10 +1307,22 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    if (add_range(ranges, newp, size, tracenum, i) == 0)
 		return 0;
 
+	    /* ADDED: cgw
+	     * Make sure that the new block contains the data from the old 
+	     * block and then fill in the new block with the low order byte
+	     * of the new index
+	     */
+	    oldsize = trace->block_sizes[index];
+	    if (size < oldsize) oldsize = size;
+	    for (j = 0; j < oldsize; j++) {
+	      if ((unsigned char)newp[j] != (index & 0xFF)) {
+		malloc_error(tracenum, i, "mm_realloc did not preserve the "
+			     "data from old block");
+		return 0;
+	      }
+	    }
 	    memset(newp, index & 0xFF, size);
 
-            mm_free(oldp);
-
 	    /* Remember region */
 	    trace->blocks[index] = newp;
 	    trace->block_sizes[index] = size;
@@ -641,10 +1330,55 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 
         case FREE: /* mm_free */
 	    
-	    /* Remove region from list and call student's free function */
+	    /* Remove region from list and call student's free function;
+	     * an arena block is released with its arena */
 	    p = trace->blocks[index];
 	    remove_range(ranges, p);
-	    mm_free(p);
+	    if (trace->block_arena[index] >= 0)
+		trace->block_arena[index] = -1;
+	    else
+		mm_free(p);
+	    break;
+
+	case ARENA_BEGIN:
+	    if ((trace->arenas[index] = mm_arena_create()) == NULL) {
+		malloc_error(tracenum, i, "mm_arena_create failed.");
+		return 0;
+	    }
+	    break;
+
+	case ARENA_END:
+	    /* Blocks the trace did not free die with their arena */
+	    for (j = 0; j < trace->num_ids; j++) {
+		if (trace->block_arena[j] == index) {
+		    remove_range(ranges, trace->blocks[j]);
+		    trace->block_arena[j] = -1;
+		}
+	    }
+	    mm_arena_destroy(trace->arenas[index]);
+	    break;
+
+	case BATCH_ALLOC: /* mm_malloc_batch; batches never come from arenas */
+	    if (mm_malloc_batch(size, trace->ops[i].count, 
+				(void **)&trace->blocks[index]) != 
+		(size_t)trace->ops[i].count) {
+		malloc_error(tracenum, i, "mm_malloc_batch failed.");
+		return 0;
+	    }
+	    for (j = index; j < index + trace->ops[i].count; j++) {
+		p = trace->blocks[j];
+		if (add_range(ranges, p, size, tracenum, i) == 0)
+		    return 0;
+		memset(p, j & 0xFF, size);
+		trace->block_sizes[j] = size;
+		trace->block_arena[j] = -1;
+	    }
+	    break;
+
+	case BATCH_FREE: /* mm_free_batch */
+	    for (j = index; j < index + trace->ops[i].count; j++)
+		remove_range(ranges, trace->blocks[j]);
+	    mm_free_batch((void **)&trace->blocks[index], trace->ops[i].count);
 	    break;
 
 	default:
@@ -670,11 +1404,11 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   is always the high water mark of the heap. 
  *   
  */
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, double *inst_ratio)
+static double eval_mm_util(trace_t *trace, double *inst_ratio, size_t *peak_heap)
 {   
-    int i;
+    int i, j;
     int index;
-    int size, newsize, oldsize;
+    int size, newsize, oldsize, arena;
     size_t max_total_size = 0, max_heap_size = 0;
     size_t heap_size = 0, total_size = 0;
     double ratio, ratio_frac, accum_ratio_frac = 1.0, accum_ratio_exp = 0.0;
@@ -693,12 +1427,18 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, doubl
 	    index = trace->ops[i].index;
 	    size = trace->ops[i].size;
 
-	    if ((p = mm_malloc(size)) == NULL) 
+	    arena = trace->ops[i].arena;
+	    if (arena >= 0)
+		p = mm_arena_alloc(trace->arenas[arena], size);
+	    else
+		p = mm_malloc(size);
+	    if (p == NULL) 
 		app_error("mm_malloc failed in eval_mm_util");
 	    
 	    /* Remember region and size */
 	    trace->blocks[index] = p;
 	    trace->block_sizes[index] = size;
+	    trace->block_arena[index] = arena;
 	    
 	    /* Keep track of current total size
 	     * of all allocated blocks */
@@ -706,17 +1446,20 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, doubl
 
             break;
 
-	case REALLOC: /* mm_mealloc + mm_free */
+	case REALLOC: /* mm_realloc */
 	    index = trace->ops[i].index;
 	    newsize = trace->ops[i].size;
 	    oldsize = trace->block_sizes[index];
 
 	    oldp = trace->blocks[index];
-	    if ((newp = mm_malloc(newsize)) == NULL)
+	    arena = trace->block_arena[index];
+	    if (arena >= 0)
+		newp = mm_arena_realloc(trace->arenas[arena], oldp, oldsize, newsize);
+	    else
+		newp = mm_realloc(oldp,newsize);
+	    if (newp == NULL)
 		app_error("mm_realloc failed in eval_mm_util");
 
-            mm_free(oldp);
-
 	    /* Remember region and size */
 	    trace->blocks[index] = newp;
 	    trace->block_sizes[index] = newsize;
@@ -732,7 +1475,10 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, doubl
 	    size = trace->block_sizes[index];
 	    p = trace->blocks[index];
 	    
-	    mm_free(p);
+	    if (trace->block_arena[index] >= 0)
+		trace->block_arena[index] = -1;
+	    else
+		mm_free(p);
 	    
 	    /* Keep track of current total size
 	     * of all allocated blocks */
@@ -740,6 +1486,45 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, doubl
 	    
 	    break;
 
+	case ARENA_BEGIN:
+	    index = trace->ops[i].index;
+	    if ((trace->arenas[index] = mm_arena_create()) == NULL)
+		app_error("mm_arena_create failed in eval_mm_util");
+	    break;
+
+	case ARENA_END:
+	    /* Blocks the trace did not free die with their arena */
+	    index = trace->ops[i].index;
+	    for (j = 0; j < trace->num_ids; j++) {
+		if (trace->block_arena[j] == index) {
+		    total_size -= trace->block_sizes[j];
+		    trace->block_arena[j] = -1;
+		}
+	    }
+	    mm_arena_destroy(trace->arenas[index]);
+	    break;
+
+	case BATCH_ALLOC: /* mm_malloc_batch */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    if (mm_malloc_batch(size, trace->ops[i].count, 
+				(void **)&trace->blocks[index]) != 
+		(size_t)trace->ops[i].count)
+		app_error("mm_malloc_batch failed in eval_mm_util");
+	    for (j = index; j < index + trace->ops[i].count; j++) {
+		trace->block_sizes[j] = size;
+		trace->block_arena[j] = -1;
+	    }
+	    total_size += (size_t)size * trace->ops[i].count;
+	    break;
+
+	case BATCH_FREE: /* mm_free_batch */
+	    index = trace->ops[i].index;
+	    mm_free_batch((void **)&trace->blocks[index], trace->ops[i].count);
+	    for (j = index; j < index + trace->ops[i].count; j++)
+		total_size -= trace->block_sizes[j];
+	    break;
+
 	default:
 	    app_error("Nonexistent request type in eval_mm_util");
 
@@ -775,6 +1560,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, doubl
     // printf("%ld %f\n", max_total_size, ratio);
 
     *inst_ratio = ratio;
+    *peak_heap = max_heap_size;
 
     return (double)max_total_size / max_heap_size;;
 }
@@ -782,53 +1568,668 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, doubl
 
 /*
  * eval_mm_speed - This is the function that is used by fcyc()
- *    to measure the running time of the mm malloc package.
+ *    to measure the running time of the mm malloc package. With
+ *    params->lat set it also times every request on its own, and with
+ *    params->touch set it uses the payloads as an application would.
  */
 static void eval_mm_speed(void *ptr)
 {
-    int i, index, size, newsize;
+    int i, j, index, size, newsize, arena;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
+    lat_hist_t *lat = ((speed_t *)ptr)->lat;
+    touch_t *touch = ((speed_t *)ptr)->touch;
+    uint64_t t0 = 0;
 
     /* Reset the heap and initialize the mm package */
     if (mm_init() < 0) 
 	app_error("mm_init failed in eval_mm_speed");
 
     /* Interpret each trace request */
-    for (i = 0;  i < trace->num_ops;  i++)
+    for (i = 0;  i < trace->num_ops;  i++) {
+        if (lat || touch)
+            t0 = lat_ticks();
+
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_malloc */
             index = trace->ops[i].index;
             size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
+            arena = trace->ops[i].arena;
+            if (arena >= 0) {
+                p = mm_arena_alloc(trace->arenas[arena], size);
+                trace->block_sizes[index] = size;
+            } else {
+                p = mm_malloc(size);
+            }
+            if (p == NULL)
 		app_error("mm_malloc error in eval_mm_speed");
             trace->blocks[index] = p;
+            trace->block_arena[index] = arena;
             break;
 
-	case REALLOC: /* mm_malloc + mm_free */
+	case REALLOC: /* mm_realloc */
 	    index = trace->ops[i].index;
             newsize = trace->ops[i].size;
 	    oldp = trace->blocks[index];
-            if ((newp = mm_malloc(newsize)) == NULL)
+            arena = trace->block_arena[index];
+            if (arena >= 0) {
+                newp = mm_arena_realloc(trace->arenas[arena], oldp,
+                                        trace->block_sizes[index], newsize);
+                trace->block_sizes[index] = newsize;
+            } else {
+                newp = mm_realloc(oldp, newsize);
+            }
+            if (newp == NULL)
 		app_error("mm_realloc error in eval_mm_speed");
-            mm_free(oldp);
             trace->blocks[index] = newp;
             break;
 
         case FREE: /* mm_free */
             index = trace->ops[i].index;
             block = trace->blocks[index];
-            mm_free(block);
+            if (trace->block_arena[index] < 0)
+                mm_free(block);
+            break;
+
+	case ARENA_BEGIN:
+            index = trace->ops[i].index;
+            if ((trace->arenas[index] = mm_arena_create()) == NULL)
+		app_error("mm_arena_create error in eval_mm_speed");
+            break;
+
+	case ARENA_END:
+            mm_arena_destroy(trace->arenas[trace->ops[i].index]);
+            break;
+
+	case BATCH_ALLOC: /* mm_malloc_batch */
+            index = trace->ops[i].index;
+            if (mm_malloc_batch(trace->ops[i].size, trace->ops[i].count,
+                                (void **)&trace->blocks[index]) !=
+                (size_t)trace->ops[i].count)
+		app_error("mm_malloc_batch error in eval_mm_speed");
+            for (j = index; j < index + trace->ops[i].count; j++)
+                trace->block_arena[j] = -1;
+            break;
+
+	case BATCH_FREE: /* mm_free_batch */
+            mm_free_batch((void **)&trace->blocks[trace->ops[i].index],
+                          trace->ops[i].count);
             break;
 
 	default:
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
 
+        if (lat)
+            lat_record(lat, trace, &trace->ops[i], lat_ticks() - t0);
+        if (touch)
+            touch_op(touch, trace, &trace->ops[i], lat_ticks() - t0);
+    }
+
     mem_reset();
 }
 
+/*
+ * eval_mm_trace - Check, measure the utilization of, and time the mm
+ *    package on one trace, filling in *stats. Given a timing lock file
+ *    (-j), the checks flock it shared and the timed runs exclusively,
+ *    so no other worker is busy while a trace is timed.
+ */
+static void eval_mm_trace(char *tracefile, int tracenum, stats_t *stats, range_t **ranges,
+			  int latency, int counters, int timing)
+{
+    trace_t *trace;
+    speed_t speed_params;
+
+    if (timing >= 0)
+	flock(timing, LOCK_SH);
+    trace = read_trace(tracedir, tracefile);
+    stats->ops = trace->num_reqs;
+    if (verbose > 1)
+	printf("Checking mm_malloc for correctness, ");
+    stats->valid = eval_mm_valid(trace, tracenum, ranges);
+    stats->policy = mm_fit_policy_name(mm_fit_policy());
+    if (stats->valid) {
+	if (verbose > 1)
+	    printf("efficiency, ");
+	stats->util = eval_mm_util(trace, &stats->inst_util, &stats->peak_heap);
+    }
+    if (timing >= 0)
+	flock(timing, LOCK_UN);
+
+    if (stats->valid) {
+	speed_params.trace = trace;
+	speed_params.ranges = *ranges;
+	speed_params.lat = NULL;
+	speed_params.touch = NULL;
+	if (verbose > 1)
+	    printf("and performance.\n");
+	if (timing >= 0)
+	    flock(timing, LOCK_EX);
+	stats->secs = fsecs(eval_mm_speed, &speed_params);
+	stats->secs_cv = fsecs_cv();
+	stats->secs_settled = fsecs_settled();
+	if (counters) {
+	    perfctr_count(eval_mm_speed, &speed_params, stats->perf);
+	    stats->counted = 1;
+	}
+
+	/* One more run, warm from the timed ones, stamping each request */
+	if (latency) {
+	    stats->lat = calloc(LAT_NUM_OPS, sizeof(lat_hist_t));
+	    if (stats->lat == NULL)
+		unix_error("lat calloc in eval_mm_trace failed");
+	    speed_params.lat = stats->lat;
+	    eval_mm_speed(&speed_params);
+	    speed_params.lat = NULL;
+	}
+	if (touch_frac >= 0)
+	    eval_mm_touch(&speed_params, stats);
+	if (timing >= 0)
+	    flock(timing, LOCK_UN);
+    }
+    free_trace(trace);
+}
+
+/*
+ * read_full, write_full - Move exactly len bytes through a pipe;
+ *    return 0 if the other end went away first
+ */
+static int read_full(int fd, void *buf, size_t len)
+{
+    ssize_t k;
+
+    while (len > 0) {
+	if ((k = read(fd, buf, len)) <= 0) {
+	    if (k < 0 && errno == EINTR)
+		continue;
+	    return 0;
+	}
+	buf = (char *)buf + k;
+	len -= k;
+    }
+    return 1;
+}
+
+static int write_full(int fd, const void *buf, size_t len)
+{
+    ssize_t k;
+
+    while (len > 0) {
+	if ((k = write(fd, buf, len)) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    return 0;
+	}
+	buf = (const char *)buf + k;
+	len -= k;
+    }
+    return 1;
+}
+
+/*
+ * eval_mm_worker - Body of one -j worker process: evaluate one trace
+ *    pinned to cpu, and send its stats_t, error count and, with -L,
+ *    latency histograms to the parent through fd
+ */
+static void eval_mm_worker(char *tracefile, int tracenum, int cpu, int fd,
+			   int latency, int counters, char *timing_path)
+{
+    stats_t stats;
+    range_t *ranges = NULL;
+    cpu_set_t one;
+    int timing = -1;
+
+    /* our own open of the lock file, since flock locks belong to one */
+    if (timing_path && (timing = open(timing_path, O_RDWR)) < 0)
+	unix_error("Could not open the timing lock in eval_mm_worker");
+
+    CPU_ZERO(&one);
+    CPU_SET(cpu, &one);
+    sched_setaffinity(0, sizeof(one), &one); /* a hint; run anywhere if refused */
+
+    /* the parent's counters count the parent, so open our own */
+    if (counters)
+	init_perfctr(0);
+
+    errors = 0; /* the parent's count so far came with the fork */
+    memset(&stats, 0, sizeof(stats));
+    eval_mm_trace(tracefile, tracenum, &stats, &ranges, latency, counters, timing);
+    fflush(stdout);
+    if (!write_full(fd, &stats, sizeof(stats)) ||
+	!write_full(fd, &errors, sizeof(errors)) ||
+	(stats.lat && !write_full(fd, stats.lat, LAT_NUM_OPS * sizeof(lat_hist_t))))
+	_exit(1);
+    _exit(0);
+}
+
+/*
+ * eval_mm_parallel - Evaluate each trace in a worker process of its
+ *    own, up to jobs at a time, each pinned to one of our CPUs. Forking
+ *    keeps every trace's mm and memlib state apart, as in a serial run.
+ *    Unless serialize is clear (-J), the workers share a timing lock
+ *    so that timed runs never overlap anything else. It is an flock on
+ *    a scratch file, so a worker that crashes cannot leave it held.
+ */
+static void eval_mm_parallel(char **tracefiles, int n, stats_t *stats, int jobs,
+			     int serialize, int latency, int counters)
+{
+    char timing_path[] = "/tmp/mdriver-lock-XXXXXX";
+    int timing = -1;
+    cpu_set_t allowed;
+    int *cpus, num_cpus = 0;
+    pid_t *pids;                /* worker in each slot, or 0 */
+    int *fds, *traces;          /* its pipe and trace number */
+    struct pollfd *polls;
+    int next = 0, running = 0, s, k = 0, ok, status, cpu, pipefd[2];
+    stats_t *st;
+
+    if (serialize && (timing = mkstemp(timing_path)) < 0)
+	unix_error("mkstemp failed in eval_mm_parallel");
+
+    /* the CPUs we may run on, in order */
+    cpus = malloc(CPU_SETSIZE * sizeof(int));
+    if (cpus == NULL)
+	unix_error("malloc failed in eval_mm_parallel");
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+	    if (CPU_ISSET(cpu, &allowed))
+		cpus[num_cpus++] = cpu;
+    if (num_cpus == 0)
+	cpus[num_cpus++] = 0;
+
+    pids = calloc(jobs, sizeof(pid_t));
+    fds = calloc(jobs, sizeof(int));
+    traces = calloc(jobs, sizeof(int));
+    polls = calloc(jobs, sizeof(struct pollfd));
+    if (!pids || !fds || !traces || !polls)
+	unix_error("calloc failed in eval_mm_parallel");
+
+    while (next < n || running > 0) {
+	/* Fill every free slot with the next trace */
+	for (s = 0; s < jobs && next < n; s++) {
+	    if (pids[s])
+		continue;
+	    if (pipe(pipefd) < 0)
+		unix_error("pipe failed in eval_mm_parallel");
+	    fflush(stdout); /* or the worker prints it again */
+	    if ((pids[s] = fork()) < 0)
+		unix_error("fork failed in eval_mm_parallel");
+	    if (pids[s] == 0) {
+		close(pipefd[0]);
+		eval_mm_worker(tracefiles[next], next, cpus[s % num_cpus], pipefd[1],
+			       latency, counters, serialize ? timing_path : NULL);
+	    }
+	    close(pipefd[1]);
+	    fds[s] = pipefd[0];
+	    traces[s] = next++;
+	    running++;
+	}
+
+	/* Collect whichever workers are done */
+	for (s = 0; s < jobs; s++) {
+	    polls[s].fd = pids[s] ? fds[s] : -1;
+	    polls[s].events = POLLIN;
+	    polls[s].revents = 0;
+	}
+	if (poll(polls, jobs, -1) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    unix_error("poll failed in eval_mm_parallel");
+	}
+	for (s = 0; s < jobs; s++) {
+	    if (!pids[s] || !polls[s].revents)
+		continue;
+	    st = &stats[traces[s]];
+	    ok = read_full(fds[s], st, sizeof(stats_t)) &&
+		read_full(fds[s], &k, sizeof(k));
+	    if (ok && st->lat) { /* the worker's pointer: the histograms follow */
+		st->lat = calloc(LAT_NUM_OPS, sizeof(lat_hist_t));
+		ok = st->lat &&
+		    read_full(fds[s], st->lat, LAT_NUM_OPS * sizeof(lat_hist_t));
+	    }
+	    close(fds[s]);
+	    waitpid(pids[s], &status, 0);
+
+	    if (ok) {
+		errors += k;
+	    } else {
+		memset(st, 0, sizeof(stats_t));
+		st->policy = mm_fit_policy_name(mm_fit_policy());
+		errors++;
+		if (WIFSIGNALED(status))
+		    printf("ERROR [trace %d]: worker killed by signal %d\n",
+			   traces[s], WTERMSIG(status));
+		else
+		    printf("ERROR [trace %d]: worker exited with status %d\n",
+			   traces[s], WEXITSTATUS(status));
+	    }
+	    pids[s] = 0;
+	    running--;
+	}
+    }
+
+    free(cpus);
+    free(pids);
+    free(fds);
+    free(traces);
+    free(polls);
+    if (timing >= 0) {
+	close(timing);
+	unlink(timing_path);
+    }
+}
+
+/*
+ * replay_fail - Note that request op of a checked threaded replay went
+ *    wrong, unless an earlier one already did.
+ */
+static void replay_fail(replay_t *params, int op, char *msg)
+{
+    if (params->err_op < 0) {
+	params->err_op = op;
+	params->err_msg = msg;
+    }
+}
+
+/*
+ * replay_check - Check that the size payload bytes at p all still hold
+ *    fill. Returns 0 and notes request op as failed if not.
+ */
+static int replay_check(replay_t *params, int op, char *p, int size, unsigned char fill)
+{
+    int j;
+
+    for (j = 0; j < size; j++)
+	if ((unsigned char)p[j] != fill) {
+	    replay_fail(params, op, "Payload changed while the block was allocated");
+	    return 0;
+	}
+    return 1;
+}
+
+/*
+ * replay_fill - Check that the new block p of a checked threaded
+ *    replay is aligned and fill its payload.
+ */
+static void replay_fill(replay_t *params, int op, char *p, int size, unsigned char fill)
+{
+    if (!IS_ALIGNED(p))
+	replay_fail(params, op, "Payload address not aligned");
+    memset(p, fill, size);
+}
+
+/*
+ * replay_handoff - Hand the count blocks from index on, which request
+ *    op frees, to the next thread to free (-X).
+ */
+static void replay_handoff(replay_t *params, int op, int index, int count)
+{
+    mailbox_t *out = params->out;
+    int j, t = out->tail;
+
+    for (j = 0; j < count; j++, t++) {
+	out->blocks[t] = params->blocks[index + j];
+	out->slots[t].op = op;
+	out->slots[t].count = (j == 0) ? count : 0;
+	out->slots[t].size = params->sizes[index + j];
+	out->slots[t].fill = REPLAY_FILL(params->self, index + j);
+    }
+    /* Publish the slots only once they are all written */
+    __atomic_store_n(&out->tail, t, __ATOMIC_RELEASE);
+}
+
+/*
+ * replay_drain - Free the blocks handed to this thread so far (-X).
+ *    With wait, keep at it until the thread handing them on is done.
+ */
+static void replay_drain(replay_t *params, int wait)
+{
+    mailbox_t *in = params->in;
+    handoff_t *h;
+    int j, done, tail;
+
+    for (;;) {
+	/* done before tail: once done is seen, tail is final */
+	done = __atomic_load_n(&in->done, __ATOMIC_ACQUIRE);
+	tail = __atomic_load_n(&in->tail, __ATOMIC_ACQUIRE);
+	while (in->head < tail) {
+	    h = &in->slots[in->head];
+	    if (params->check)
+		for (j = 0; j < h->count; j++)
+		    replay_check(params, h[j].op, in->blocks[in->head + j],
+				 h[j].size, h[j].fill);
+	    if (h->count == 1)
+		mm_free(in->blocks[in->head]);
+	    else
+		mm_free_batch(&in->blocks[in->head], h->count);
+	    in->head += h->count;
+	}
+	if (!wait || done)
+	    break;
+	sched_yield();
+    }
+}
+
+/*
+ * replay_thread - Body of one thread of eval_mm_threads: replays the
+ *    whole trace against the mm package, like eval_mm_speed. With
+ *    params->out, the blocks it frees go to the next thread instead,
+ *    and with params->in, it frees the ones the thread after it frees.
+ */
+static void *replay_thread(void *ptr)
+{
+    replay_t *params = (replay_t *)ptr;
+    trace_t *trace = params->trace;
+    char **blocks = params->blocks;
+    int *sizes = params->sizes;
+    char *p;
+    int i, j, index, size, count, oldsize;
+
+    pthread_barrier_wait(params->start);
+    clock_gettime(CLOCK_MONOTONIC, &params->t0);
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	if (params->in != NULL)
+	    replay_drain(params, 0);
+
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+	count = trace->ops[i].count;
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* mm_malloc */
+            if ((p = mm_malloc(size)) == NULL)
+		app_error("mm_malloc error in replay_thread");
+	    if (params->check)
+		replay_fill(params, i, p, size, REPLAY_FILL(params->self, index));
+            blocks[index] = p;
+	    sizes[index] = size;
+            break;
+
+	case REALLOC: /* mm_realloc */
+            if ((p = mm_realloc(blocks[index], size)) == NULL)
+		app_error("mm_realloc error in replay_thread");
+	    if (params->check) {
+		oldsize = (sizes[index] < size) ? sizes[index] : size;
+		if (replay_check(params, i, p, oldsize, REPLAY_FILL(params->self, index)))
+		    replay_fill(params, i, p, size, REPLAY_FILL(params->self, index));
+	    }
+            blocks[index] = p;
+	    sizes[index] = size;
+            break;
+
+        case FREE: /* mm_free */
+	    if (params->out != NULL) {
+		replay_handoff(params, i, index, 1);
+		break;
+	    }
+	    if (params->check)
+		replay_check(params, i, blocks[index], sizes[index],
+			     REPLAY_FILL(params->self, index));
+            mm_free(blocks[index]);
+            break;
+
+	case ARENA_BEGIN: /* arena scopes are replayed as plain malloc/free */
+	case ARENA_END:
+	    break;
+
+	case BATCH_ALLOC: /* mm_malloc_batch */
+            if (mm_malloc_batch(size, count, (void **)&blocks[index]) !=
+                (size_t)count)
+		app_error("mm_malloc_batch error in replay_thread");
+	    for (j = index; j < index + count; j++) {
+		if (params->check)
+		    replay_fill(params, i, blocks[j], size, REPLAY_FILL(params->self, j));
+		sizes[j] = size;
+	    }
+            break;
+
+	case BATCH_FREE: /* mm_free_batch */
+	    if (params->out != NULL) {
+		if (count > 0)
+		    replay_handoff(params, i, index, count);
+		break;
+	    }
+	    if (params->check)
+		for (j = index; j < index + count; j++)
+		    replay_check(params, i, blocks[j], sizes[j], REPLAY_FILL(params->self, j));
+            mm_free_batch((void **)&blocks[index], count);
+            break;
+
+	default:
+	    app_error("Nonexistent request type in replay_thread");
+        }
+    }
+
+    /* Let the thread freeing this one's blocks finish, then finish
+       freeing the next one's */
+    if (params->out != NULL)
+	__atomic_store_n(&params->out->done, 1, __ATOMIC_RELEASE);
+    if (params->in != NULL)
+	replay_drain(params, 1);
+
+    clock_gettime(CLOCK_MONOTONIC, &params->t1);
+    return NULL;
+}
+
+/*
+ * eval_mm_threads - Replay the trace in nthreads threads at once, all
+ *    sharing one mm heap, and return the wall-clock time from the first
+ *    thread's start to the last thread's finish for the fastest of
+ *    THREAD_RUNS runs. With handoff, thread i frees the blocks thread
+ *    (i+1) % nthreads allocated. An untimed run first checks payloads
+ *    as eval_mm_valid does; if they fail, returns -1 instead.
+ */
+static double eval_mm_threads(trace_t *trace, int tracenum, int nthreads, int handoff)
+{
+    pthread_t *tids;
+    replay_t *params;
+    mailbox_t *mailboxes = NULL;
+    char **blocks;
+    int *sizes;
+    pthread_barrier_t start;
+    double t0, t1, secs, best = DBL_MAX;
+    int i, run, nfrees = 0, failed = 0;
+
+    tids = (pthread_t *)malloc(nthreads * sizeof(pthread_t));
+    params = (replay_t *)malloc(nthreads * sizeof(replay_t));
+    blocks = (char **)malloc((size_t)nthreads * trace->num_ids * sizeof(char *));
+    sizes = (int *)malloc((size_t)nthreads * trace->num_ids * sizeof(int));
+    if (tids == NULL || params == NULL || blocks == NULL || sizes == NULL)
+	unix_error("malloc failed in eval_mm_threads");
+
+    /* Each mailbox has room for every block the trace frees */
+    if (handoff) {
+	for (i = 0; i < trace->num_ops; i++)
+	    if (trace->ops[i].type == FREE)
+		nfrees++;
+	    else if (trace->ops[i].type == BATCH_FREE)
+		nfrees += trace->ops[i].count;
+	mailboxes = (mailbox_t *)malloc(nthreads * sizeof(mailbox_t));
+	if (mailboxes == NULL)
+	    unix_error("malloc failed in eval_mm_threads");
+	for (i = 0; i < nthreads; i++) {
+	    mailboxes[i].blocks = (void **)malloc((nfrees + 1) * sizeof(void *));
+	    mailboxes[i].slots = (handoff_t *)malloc((nfrees + 1) * sizeof(handoff_t));
+	    if (mailboxes[i].blocks == NULL || mailboxes[i].slots == NULL)
+		unix_error("malloc failed in eval_mm_threads");
+	}
+    }
+
+    /* Run 0 checks payloads; the THREAD_RUNS after it are timed */
+    for (run = 0; run <= THREAD_RUNS && !failed; run++) {
+	if (mm_init() < 0)
+	    app_error("mm_init failed in eval_mm_threads");
+
+	pthread_barrier_init(&start, NULL, nthreads + 1);
+	for (i = 0; i < nthreads; i++) {
+	    params[i].trace = trace;
+	    params[i].self = i;
+	    params[i].blocks = blocks + (size_t)i * trace->num_ids;
+	    params[i].sizes = sizes + (size_t)i * trace->num_ids;
+	    params[i].out = NULL;
+	    params[i].in = NULL;
+	    if (handoff) {
+		/* Thread i's frees go to mailbox i, which thread i-1 empties */
+		mailboxes[i].tail = mailboxes[i].head = mailboxes[i].done = 0;
+		params[i].out = &mailboxes[i];
+		params[i].in = &mailboxes[(i + 1) % nthreads];
+	    }
+	    params[i].check = (run == 0);
+	    params[i].err_op = -1;
+	    params[i].err_msg = NULL;
+	    params[i].start = &start;
+	}
+	for (i = 0; i < nthreads; i++)
+	    if (pthread_create(&tids[i], NULL, replay_thread, &params[i]) != 0)
+		unix_error("pthread_create failed in eval_mm_threads");
+
+	pthread_barrier_wait(&start);
+	for (i = 0; i < nthreads; i++)
+	    pthread_join(tids[i], NULL);
+	pthread_barrier_destroy(&start);
+
+	mem_reset();
+
+	for (i = 0; i < nthreads; i++)
+	    if (params[i].err_op >= 0) {
+		malloc_error(tracenum, params[i].err_op, params[i].err_msg);
+		failed = 1;
+	    }
+	if (run == 0)
+	    continue;
+
+	t0 = DBL_MAX;
+	t1 = 0;
+	for (i = 0; i < nthreads; i++) {
+	    secs = params[i].t0.tv_sec + params[i].t0.tv_nsec / 1e9;
+	    if (secs < t0)
+		t0 = secs;
+	    secs = params[i].t1.tv_sec + params[i].t1.tv_nsec / 1e9;
+	    if (secs > t1)
+		t1 = secs;
+	}
+	secs = t1 - t0;
+	if (secs < best)
+	    best = secs;
+    }
+
+    if (handoff) {
+	for (i = 0; i < nthreads; i++) {
+	    free(mailboxes[i].blocks);
+	    free(mailboxes[i].slots);
+	}
+	free(mailboxes);
+    }
+    free(sizes);
+    free(blocks);
+    free(params);
+    free(tids);
+    return failed ? -1 : best;
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -837,7 +2238,7 @@ static void eval_mm_speed(void *ptr)
  */
 static int eval_libc_valid(trace_t *trace, int tracenum)
 {
-    int i, newsize;
+    int i, j, newsize;
     char *p, *newp, *oldp;
 
     for (i = 0;  i < trace->num_ops;  i++) {
@@ -865,6 +2266,25 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
 	    free(trace->blocks[trace->ops[i].index]);
 	    break;
 
+	case ARENA_BEGIN: /* libc has no arenas: plain malloc/free */
+	case ARENA_END:
+	    break;
+
+	case BATCH_ALLOC: /* libc has no batches: one malloc per block */
+	    for (j = 0; j < trace->ops[i].count; j++) {
+		if ((p = malloc(trace->ops[i].size)) == NULL) {
+		    malloc_error(tracenum, i, "libc malloc failed");
+		    unix_error("System message");
+		}
+		trace->blocks[trace->ops[i].index + j] = p;
+	    }
+	    break;
+
+	case BATCH_FREE:
+	    for (j = 0; j < trace->ops[i].count; j++)
+		free(trace->blocks[trace->ops[i].index + j]);
+	    break;
+
 	default:
 	    app_error("invalid operation type  in eval_libc_valid");
 	}
@@ -880,7 +2300,7 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
  */
 static void eval_libc_speed(void *ptr)
 {
-    int i;
+    int i, j;
     int index, size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
@@ -899,9 +2319,8 @@ static void eval_libc_speed(void *ptr)
 	    index = trace->ops[i].index;
 	    newsize = trace->ops[i].size;
 	    oldp = trace->blocks[index];
-	    if ((newp = malloc(newsize)) == NULL)
-		unix_error("malloc failed in eval_libc_speed\n");
-            free(oldp);
+	    if ((newp = realloc(oldp, newsize)) == NULL)
+		unix_error("realloc failed in eval_libc_speed\n");
 	    
 	    trace->blocks[index] = newp;
 	    break;
@@ -911,14 +2330,400 @@ static void eval_libc_speed(void *ptr)
 	    block = trace->blocks[index];
 	    free(block);
 	    break;
+
+	case ARENA_BEGIN: /* libc has no arenas: plain malloc/free */
+	case ARENA_END:
+	    break;
+
+	case BATCH_ALLOC: /* libc has no batches: one malloc per block */
+	    index = trace->ops[i].index;
+	    for (j = 0; j < trace->ops[i].count; j++) {
+		if ((p = malloc(trace->ops[i].size)) == NULL)
+		    unix_error("malloc failed in eval_libc_speed");
+		trace->blocks[index + j] = p;
+	    }
+	    break;
+
+	case BATCH_FREE:
+	    index = trace->ops[i].index;
+	    for (j = 0; j < trace->ops[i].count; j++)
+		free(trace->blocks[index + j]);
+	    break;
+	}
+    }
+}
+
+/*************************************************************
+ * Per-request latency histograms (-L). A request is timed with
+ * the cheapest counter there is, the TSC on x86, less the cost of
+ * reading it twice. A batch request's time is spread evenly over
+ * its blocks, so every request counts once as in the Kops column.
+ ************************************************************/
+
+/*
+ * lat_ticks - Read the latency timer
+ */
+static inline uint64_t lat_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static int compare_ticks(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * lat_calibrate - Find the timer's rate against CLOCK_MONOTONIC over
+ *     about 20 ms, and the median cost of two back-to-back reads
+ */
+static void lat_calibrate(void)
+{
+    uint64_t samples[LAT_CAL_SAMPLES], t0, t1;
+    struct timespec ts0, ts1;
+    double ns;
+    int i;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts0);
+    t0 = lat_ticks();
+    do {
+	clock_gettime(CLOCK_MONOTONIC, &ts1);
+	ns = (ts1.tv_sec - ts0.tv_sec) * 1e9 + (ts1.tv_nsec - ts0.tv_nsec);
+    } while (ns < 20e6);
+    t1 = lat_ticks();
+    lat_ticks_per_ns = (t1 - t0) / ns;
+
+    for (i = 0; i < LAT_CAL_SAMPLES; i++) {
+	t0 = lat_ticks();
+	samples[i] = lat_ticks() - t0;
+    }
+    qsort(samples, LAT_CAL_SAMPLES, sizeof(uint64_t), compare_ticks);
+    lat_overhead = samples[LAT_CAL_SAMPLES / 2];
+}
+
+/*
+ * lat_bucket - The histogram bucket of a sample: values below 2*LAT_SUB
+ *     get one bucket each, then each power of two gets LAT_SUB
+ */
+static int lat_bucket(uint64_t v)
+{
+    int msb;
+
+    if (v < LAT_SUB)
+	return v;
+    msb = 63 - __builtin_clzll(v);
+    return (msb - LAT_SUB_BITS + 1) * LAT_SUB
+	+ ((v >> (msb - LAT_SUB_BITS)) & (LAT_SUB - 1));
+}
+
+/*
+ * lat_bucket_top - The largest value that falls in bucket b
+ */
+static uint64_t lat_bucket_top(int b)
+{
+    int shift = b / LAT_SUB - 1;
+
+    if (shift < 0)
+	return b;
+    return (((uint64_t)LAT_SUB + b % LAT_SUB + 1) << shift) - 1;
+}
+
+/*
+ * lat_record - Add the ticks that trace request op took to its
+ *     histogram. Arena scopes, and frees inside them, are not timed.
+ */
+static void lat_record(lat_hist_t *lat, trace_t *trace, traceop_t *op, uint64_t ticks)
+{
+    lat_hist_t *hist;
+    uint64_t n = 1;
+
+    switch (op->type) {
+    case ALLOC:
+	hist = &lat[LAT_MALLOC];
+	break;
+    case REALLOC:
+	hist = &lat[LAT_REALLOC];
+	break;
+    case FREE:
+	if (trace->block_arena[op->index] >= 0)
+	    return;
+	hist = &lat[LAT_FREE];
+	break;
+    case BATCH_ALLOC:
+    case BATCH_FREE:
+	hist = &lat[op->type == BATCH_ALLOC ? LAT_MALLOC : LAT_FREE];
+	n = op->count;
+	break;
+    default:
+	return;
+    }
+
+    ticks = (ticks > lat_overhead) ? (ticks - lat_overhead) / n : 0;
+    hist->counts[lat_bucket(ticks)] += n;
+    hist->total += n;
+    if (ticks > hist->max)
+	hist->max = ticks;
+}
+
+/*
+ * lat_percentile - The sample at quantile q of hist, in ns
+ */
+static uint64_t lat_percentile(lat_hist_t *hist, double q)
+{
+    uint64_t rank = (uint64_t)ceil(q * hist->total), seen = 0;
+    int b;
+
+    if (rank == 0)
+	rank = 1;
+    for (b = 0; b < LAT_BUCKETS; b++) {
+	seen += hist->counts[b];
+	if (seen >= rank)
+	    break;
+    }
+    if (lat_bucket_top(b) > hist->max) /* the top bucket is only as wide as max */
+	return hist->max / lat_ticks_per_ns;
+    return lat_bucket_top(b) / lat_ticks_per_ns;
+}
+
+/*
+ * printlatency - prints each trace's latency percentiles per kind
+ *     of request, for the traces timed with -L
+ */
+static void printlatency(int n, stats_t *stats)
+{
+    static const char *names[LAT_NUM_OPS] = {"malloc", "realloc", "free"};
+    lat_hist_t *hist;
+    int i, k;
+
+    printf("Latency for mm malloc (ns, less %.0f ns timer overhead):\n",
+	   lat_overhead / lat_ticks_per_ns);
+    printf("%5s%9s%10s%8s%8s%8s%9s\n",
+	   "trace", "op", "count", "p50", "p99", "p99.9", "max");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid || stats[i].lat == NULL)
+	    continue;
+	for (k = 0; k < LAT_NUM_OPS; k++) {
+	    hist = &stats[i].lat[k];
+	    if (hist->total == 0)
+		continue;
+	    printf("%2d%12s%10" PRIu64 "%8" PRIu64 "%8" PRIu64 "%8" PRIu64 "%9.0f\n",
+		   i, names[k], hist->total,
+		   lat_percentile(hist, 0.50),
+		   lat_percentile(hist, 0.99),
+		   lat_percentile(hist, 0.999),
+		   hist->max / lat_ticks_per_ns);
 	}
     }
 }
 
+/*************************************************************
+ * Payload-touching replay (-W). The trace runs once more with
+ * touch_op after every request, which first books the request's
+ * ticks to the allocator and then times its own payload writes and
+ * reads separately, so the two costs are reported apart.
+ ************************************************************/
+
+/* Append block id as the newest live block */
+static void touch_link(touch_t *touch, int id, int size)
+{
+    touch->size[id] = size;
+    touch->prev[id] = touch->tail;
+    touch->next[id] = -1;
+    if (touch->tail >= 0)
+	touch->next[touch->tail] = id;
+    else
+	touch->head = id;
+    touch->tail = id;
+    touch->live++;
+}
+
+/* Drop block id from the live blocks, if it is one */
+static void touch_unlink(touch_t *touch, int id)
+{
+    if (touch->size[id] < 0)
+	return;
+    if (touch->prev[id] >= 0)
+	touch->next[touch->prev[id]] = touch->next[id];
+    else
+	touch->head = touch->next[id];
+    if (touch->next[id] >= 0)
+	touch->prev[touch->next[id]] = touch->prev[id];
+    else
+	touch->tail = touch->prev[id];
+    touch->size[id] = -1;
+    touch->live--;
+}
+
+/* Write every byte of block id's new payload */
+static void touch_write(touch_t *touch, trace_t *trace, int id, int size)
+{
+    memset(trace->blocks[id], id, size);
+    touch->bytes += size;
+}
+
+/*
+ * touch_op - Book the ticks request op took, then replay what the
+ *     application does around it: write the payloads it allocated,
+ *     and read one byte per cache line of the newest live blocks,
+ *     touch_frac of them per request
+ */
+static void touch_op(touch_t *touch, trace_t *trace, traceop_t *op, uint64_t ticks)
+{
+    uint64_t t0 = lat_ticks();
+    int j, id, k, off, reps = 1;
+    unsigned char *p;
+
+    touch->alloc_ticks += (ticks > lat_overhead) ? ticks - lat_overhead : 0;
+
+    switch (op->type) {
+    case ALLOC:
+	touch_link(touch, op->index, op->size);
+	touch_write(touch, trace, op->index, op->size);
+	break;
+    case REALLOC: /* a grown block is in use again, so it is newest */
+	touch_unlink(touch, op->index);
+	touch_link(touch, op->index, op->size);
+	touch_write(touch, trace, op->index, op->size);
+	break;
+    case BATCH_ALLOC:
+	for (j = op->index; j < op->index + op->count; j++) {
+	    touch_link(touch, j, op->size);
+	    touch_write(touch, trace, j, op->size);
+	}
+	reps = op->count;
+	break;
+    case FREE:
+	touch_unlink(touch, op->index);
+	break;
+    case BATCH_FREE:
+	for (j = op->index; j < op->index + op->count; j++)
+	    touch_unlink(touch, j);
+	reps = op->count;
+	break;
+    case ARENA_END: /* blocks the trace did not free die with their arena */
+	for (id = touch->head; id >= 0; id = j) {
+	    j = touch->next[id];
+	    if (trace->block_arena[id] == op->index)
+		touch_unlink(touch, id);
+	}
+	return;
+    default:
+	return;
+    }
+
+    /* once per request, so a batch reads as much as its -B split */
+    for (; reps > 0; reps--) {
+	k = (int)ceil(touch_frac * touch->live);
+	for (id = touch->tail; id >= 0 && k > 0; id = touch->prev[id], k--) {
+	    p = (unsigned char *)trace->blocks[id];
+	    for (off = 0; off < touch->size[id]; off += 64)
+		touch->sink += p[off];
+	    touch->bytes += touch->size[id];
+	}
+    }
+
+    t0 = lat_ticks() - t0;
+    touch->touch_ticks += (t0 > lat_overhead) ? t0 - lat_overhead : 0;
+}
+
+/*
+ * eval_mm_touch - Run the trace once more touching payloads, and
+ *     record the time in the mm package and in the touches apart
+ */
+static void eval_mm_touch(speed_t *speed_params, stats_t *stats)
+{
+    int n = speed_params->trace->num_ids, i;
+    touch_t touch;
+
+    memset(&touch, 0, sizeof(touch));
+    touch.prev = malloc(n * sizeof(int));
+    touch.next = malloc(n * sizeof(int));
+    touch.size = malloc(n * sizeof(int));
+    if (!touch.prev || !touch.next || !touch.size)
+	unix_error("malloc failed in eval_mm_touch");
+    for (i = 0; i < n; i++)
+	touch.size[i] = -1;
+    touch.head = touch.tail = -1;
+
+    speed_params->touch = &touch;
+    eval_mm_speed(speed_params);
+    speed_params->touch = NULL;
+
+    stats->alloc_secs = touch.alloc_ticks / lat_ticks_per_ns / 1e9;
+    stats->touch_secs = touch.touch_ticks / lat_ticks_per_ns / 1e9;
+    stats->touch_bytes = touch.bytes;
+    touch_sink = touch.sink;
+    free(touch.prev);
+    free(touch.next);
+    free(touch.size);
+}
+
+/*
+ * printtouch - prints the allocator and payload-touching costs of
+ *     each trace from the -W run
+ */
+static void printtouch(int n, stats_t *stats)
+{
+    int i;
+
+    printf("Payload touches for mm malloc (%.0f%% of live blocks read per request):\n",
+	   touch_frac * 100);
+    printf("%5s%10s%8s%10s%8s%8s\n",
+	   "trace", "mm secs", "Kops", "touch", "ns/op", "KB/op");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid)
+	    continue;
+	printf("%2d%13.6f%8.0f%10.6f%8.0f%8.1f\n", i,
+	       stats[i].alloc_secs,
+	       (stats[i].ops / 1e3) / stats[i].alloc_secs,
+	       stats[i].touch_secs,
+	       stats[i].touch_secs * 1e9 / stats[i].ops,
+	       stats[i].touch_bytes / 1024 / stats[i].ops);
+    }
+}
+
 /*************************************
  * Some miscellaneous helper routines
  ************************************/
 
+/*
+ * printperf - prints each counted trace's hardware counters, per
+ *     request, with instructions per cycle when both were counted
+ */
+static void printperf(int n, stats_t *stats, char *name)
+{
+    int i, k;
+
+    printf("\nHardware counters for %s (per request):\n", name);
+    printf("%5s", "trace");
+    for (k = 0; k < PERFCTR_NUM; k++)
+	printf("%10s", perfctr_name(k));
+    printf("%6s\n", "IPC");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid || !stats[i].counted)
+	    continue;
+	printf("%2d   ", i);
+	for (k = 0; k < PERFCTR_NUM; k++) {
+	    if (stats[i].perf[k] < 0)
+		printf("%10s", "-");
+	    else
+		printf("%10.2f", stats[i].perf[k] / stats[i].ops);
+	}
+	if (stats[i].perf[PERFCTR_CYCLES] > 0 && stats[i].perf[PERFCTR_INSTRUCTIONS] >= 0)
+	    printf("%6.2f\n", stats[i].perf[PERFCTR_INSTRUCTIONS] / stats[i].perf[PERFCTR_CYCLES]);
+	else
+	    printf("%6s\n", "-");
+    }
+}
+
 
 /*
  * printresults - prints a performance summary for some malloc package
@@ -930,39 +2735,47 @@ static void printresults(int n, stats_t *stats)
     double ops = 0;
     double util = 0;
     double inst_util = 0;
+    int unsettled = 0;
 
     /* Print the individual results for each trace */
-    printf("%5s%7s %5s%7s%7s%10s%6s\n", 
-	   "trace", " valid", "util", "util_i", "ops", "secs", "Kops");
+    printf("%5s%7s%6s%7s%8s%10s%7s%8s  %s\n", 
+	   "trace", "valid", "util", "util_i", "ops", "secs", "Kops", "cv", "policy");
     for (i=0; i < n; i++) {
 	if (stats[i].valid) {
-	    printf("%2d%10s%5.0f%%%5.0f%%%8.0f%10.6f%6.0f\n", 
+	    printf("%2d%10s%5.0f%%%6.0f%%%8.0f%10.6f%7.0f%7.1f%%%c %s\n", 
 		   i,
 		   "yes",
 		   stats[i].util*100.0,
 		   stats[i].inst_util*100.0,
 		   stats[i].ops,
 		   stats[i].secs,
-		   (stats[i].ops/1e3)/stats[i].secs);
+		   (stats[i].ops/1e3)/stats[i].secs,
+		   stats[i].secs_cv*100.0,
+		   stats[i].secs_settled ? ' ' : '*',
+		   stats[i].policy);
+	    unsettled += !stats[i].secs_settled;
 	    secs += stats[i].secs;
 	    ops += stats[i].ops;
 	    util += stats[i].util;
 	    inst_util += stats[i].inst_util;
 	}
 	else {
-	    printf("%2d%10s%6s%8s%10s%6s\n", 
+	    printf("%2d%10s%6s%7s%8s%10s%7s%8s  %s\n", 
 		   i,
 		   "no",
 		   "-",
 		   "-",
 		   "-",
-		   "-");
+		   "-",
+		   "-",
+		   "-",
+		   stats[i].policy);
 	}
     }
 
     /* Print the aggregate results for the set of traces */
     if (errors == 0) {
-	printf("%12s%5.0f%%%5.0f%%%8.0f%10.6f%6.0f\n", 
+	printf("%12s%5.0f%%%6.0f%%%8.0f%10.6f%7.0f\n", 
 	       "Total       ",
 	       (util/n)*100.0,
 	       (inst_util/n)*100.0,
@@ -971,7 +2784,7 @@ static void printresults(int n, stats_t *stats)
 	       (ops/1e3)/secs);
     }
     else {
-	printf("%12s%6s%6s%8s%10s%6s\n", 
+	printf("%12s%6s%7s%8s%10s%7s\n", 
 	       "Total       ",
 	       "-", 
 	       "-", 
@@ -979,6 +2792,9 @@ static void printresults(int n, stats_t *stats)
 	       "-", 
 	       "-");
     }
+    if (unsettled)
+	printf("* timing did not settle to within %.0f%% before running out of "
+	       "samples; secs is the median of noisy runs\n", CLOCK_EPSILON * 100.0);
 
 }
 
@@ -1014,13 +2830,27 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hHvValpABLRX] [-f <file>] [-t <dir>] [-c <file>] [-C <kb>] [-j|-J <n>] [-P <policy>] [-T <n>] [-W <pct>]\n");
     fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-A         Serve arena scopes in traces with mm_malloc/mm_free.\n");
+    fprintf(stderr, "\t-B         Split batch requests in traces into single calls.\n");
+    fprintf(stderr, "\t-c <file>  Write the -f trace to <file> in binary and exit.\n");
+    fprintf(stderr, "\t-C <kb>    Park up to <kb> KB of unmapped pages for reuse (off by default).\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H         Also time large traces on huge-page backed heaps.\n");
+    fprintf(stderr, "\t-j <n>     Evaluate up to <n> traces at once, timing one at a time.\n");
+    fprintf(stderr, "\t-J <n>     Like -j, but let the timed runs overlap as well.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-L         Print p50/p99/p99.9 latency of each mm request.\n");
+    fprintf(stderr, "\t-p         Print hardware counters per request (Linux perf).\n");
+    fprintf(stderr, "\t-P <pol>   mm placement policy: first, next, best or address.\n");
+    fprintf(stderr, "\t-R         Commit the mm heap in one reserved address range.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T <n>     Also replay each trace in 1..n threads at once.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
+    fprintf(stderr, "\t-W <pct>   Also replay touching payloads, reading <pct>%% of live blocks per request.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
+    fprintf(stderr, "\t-X         With -T, have each thread free the blocks the next one allocated.\n");
 }
@@ -1,6 +1,7 @@
 /*
  * memlib.c - bridge to mmap
  */
+#define _GNU_SOURCE /* for mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -9,15 +10,126 @@
 #include <string.h>
 #include <inttypes.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "memlib.h"
 #include "pagemap.h"
 
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0 /* older headers: the address is only a hint */
+#endif
+
+#ifndef MADV_HUGEPAGE
+#define MADV_HUGEPAGE 14
+#endif
+#ifndef MADV_NOHUGEPAGE
+#define MADV_NOHUGEPAGE 15
+#endif
+
 /* private variables */
 static int activity_counter = 0; /* to simulate other processes */
+static void *spacers;            /* their pages, chained through the first word */
 
 static int page_count;
 
+/* serializes the pagemap and the counters above, so mm.c may call in
+   from several threads at once */
+static pthread_mutex_t mem_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* A range of address space handed out bump-pointer style from top.
+   Ranges given back below top are kept in an address-ordered, coalesced
+   list and handed out again first fit; one that ends at top lowers top
+   instead. The huge-page regions and the reservation both carve their
+   pages this way. */
+typedef struct mem_extent {
+  char *base;
+  size_t size;
+  struct mem_extent *next;
+} mem_extent;
+
+typedef struct mem_space {
+  char *base;
+  size_t size;
+  size_t top;                 /* bytes below this were handed out at some point */
+  mem_extent *free;           /* given-back ranges below top */
+} mem_space;
+
+/* With huge pages on (mem_set_huge), mem_map carves its pages out of
+   AHUGE_SIZE-aligned regions advised MADV_HUGEPAGE, so a heap takes a
+   few huge TLB entries instead of many small ones. Unmapped pages stay
+   in their region for the next carve; a region is unmapped only once
+   none of its pages are in use, since unmapping part of it would split
+   its huge pages again. The pagemap tracks carved pages one by one, as
+   in the other modes, so mem_unmap and mem_remap check their ranges
+   the same way. Regions are at least MEM_REGION_SIZE bytes, so large
+   blocks share them instead of each faulting in a region of its own;
+   only the pages in use are ever touched. MEM_HUGE_SMALL carves the
+   same regions but advises them MADV_NOHUGEPAGE, as a baseline that
+   differs only in page size. */
+#ifndef MEM_REGION_SIZE
+#define MEM_REGION_SIZE ((size_t)64 << 20)
+#endif
+#ifndef MEM_MOVE_MIN
+#define MEM_MOVE_MIN ((size_t)64 << 10) /* smaller ranges are copied */
+#endif
+
+typedef struct mem_region {
+  mem_space space;            /* size is a multiple of AHUGE_SIZE */
+  size_t live;                /* bytes carved and not yet unmapped */
+  struct mem_region *next;
+} mem_region;
+
+static int use_huge;          /* a MEM_HUGE_* mode */
+static mem_region *regions;   /* newest first */
+
+#define REGION_ADVICE (use_huge == MEM_HUGE_ON ? MADV_HUGEPAGE : MADV_NOHUGEPAGE)
+
+/* With reservation on (mem_set_reserve), memlib reserves MEM_RESERVE_SIZE
+   bytes of PROT_NONE address space once and hands out pages from it, so
+   the heap lives in one contiguous range. To keep syscalls off the map
+   and unmap paths, pages are committed (made accessible) with one
+   mprotect per MEM_COMMIT_STEP bytes as the handed-out part grows, and
+   are never made PROT_NONE again until mem_reset. Unmapped ranges are
+   reused still holding their contents; once more than MEM_PURGE_BYTES
+   have been unmapped, all of them are dropped with MADV_DONTNEED at
+   once. So, unlike a real munmap, a stray access to an unmapped page
+   does not fault in this mode (the pagemap still knows it is unmapped),
+   and a reused page may not be zero. */
+#ifndef MEM_RESERVE_SIZE
+#define MEM_RESERVE_SIZE ((size_t)1 << 32)
+#endif
+#ifndef MEM_COMMIT_STEP
+#define MEM_COMMIT_STEP AHUGE_SIZE
+#endif
+#ifndef MEM_PURGE_BYTES
+#define MEM_PURGE_BYTES ((size_t)4 << 20)
+#endif
+
+static int use_reserve;
+static mem_space reserve = {NULL, MEM_RESERVE_SIZE, 0, NULL}; /* base is NULL until the first mapping */
+static size_t commit_top;     /* bytes below this are accessible */
+static size_t purge_bytes;    /* bytes unmapped since the last purge */
+
+/* mem_unmap parks runs of up to MEM_CACHE_PAGES pages in a page cache,
+   binned by page count, and mem_map hands them out again for requests
+   of the same size, so a heap that keeps shrinking and growing across a
+   page boundary does not pay for an unmap and a map each time. A parked
+   run stays mapped, in the pagemap and in mem_heapsize; its first word
+   links it into its bin. At most cache_max bytes are parked (the high-
+   water mark, see mem_set_cache); mem_trim releases them. The cache is
+   off unless MEM_CACHE_MAX or mem_set_cache (mdriver -C) turns it on,
+   so by default the driver times mm.c against plain mappings. */
+#ifndef MEM_CACHE_PAGES
+#define MEM_CACHE_PAGES 16
+#endif
+#ifndef MEM_CACHE_MAX
+#define MEM_CACHE_MAX 0
+#endif
+
+static size_t cache_max = MEM_CACHE_MAX;
+static size_t cache_bytes;
+static void *cache_bins[MEM_CACHE_PAGES + 1];
+
 /* 
  * mem_init - initialize the memory system model
  */
@@ -31,23 +143,419 @@ void mem_init(void)
   }
 }
 
-static void unmap(void *p)
+
+static void reserve_clear(void);
+static mem_region *region_of(void *p);
+
+static void unmap(void *p, size_t size)
 {
-  if (munmap(p, APAGE_SIZE) < 0) {
+  if (reserve.base && (char *)p >= reserve.base
+      && (char *)p < reserve.base + MEM_RESERVE_SIZE)
+    return; /* decommitted by reserve_clear */
+  if (region_of(p))
+    return; /* unmapped with its region */
+  if (munmap(p, size) < 0) {
     fprintf(stderr, "unexpected error in munmap: %s (%d)\n",
             strerror(errno), errno);
     abort();
   }
 }
 
+static void space_clear(mem_space *s);
+
 /* 
  * mem_deinit - free the storage used by the memory system model
  */
 void mem_reset(void)
 {
   pagemap_for_each(unmap);
+  while (regions) {
+    mem_region *r = regions;
+    regions = r->next;
+    if (munmap(r->space.base, r->space.size) < 0) {
+      fprintf(stderr, "unexpected error in munmap: %s (%d)\n",
+              strerror(errno), errno);
+      abort();
+    }
+    space_clear(&r->space);
+    free(r);
+  }
+  reserve_clear();
+  memset(cache_bins, 0, sizeof(cache_bins));
+  cache_bytes = 0;
   page_count = 0;
   activity_counter = 0;
+
+  /* drop the spacers too, so each run starts from the same address
+     space however many ran before */
+  while (spacers) {
+    void *next = *(void **)spacers;
+    munmap(spacers, APAGE_SIZE);
+    spacers = next;
+  }
+}
+
+/*
+ * mem_set_huge - serve mem_map from huge-page regions (MEM_HUGE_ON),
+ *     from the same regions on base pages (MEM_HUGE_SMALL) or with
+ *     plain page mappings (MEM_HUGE_OFF). Only allowed while nothing
+ *     is mapped; turning regions on turns reservation off.
+ */
+void mem_set_huge(int mode)
+{
+  if (page_count || regions) {
+    fprintf(stderr, "mem_set_huge: pages are still mapped\n");
+    abort();
+  }
+  use_huge = mode;
+  if (mode != MEM_HUGE_OFF)
+    mem_set_reserve(0);
+}
+
+int mem_huge(void)
+{
+  return use_huge;
+}
+
+static void *mmap_or_die(size_t sz)
+{
+  void *p = mmap(0, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+  if (p == MAP_FAILED) {
+    fprintf(stderr, "mmap failed: %s (%d)\n",
+            strerror(errno), errno);
+    abort();
+  }
+  return p;
+}
+
+/* take sz bytes of s: the first given-back range that fits, else fresh
+   space at top. NULL if neither has room. */
+static void *space_take(mem_space *s, size_t sz)
+{
+  mem_extent **link, *e;
+  char *p;
+
+  for (link = &s->free; (e = *link) != NULL; link = &e->next) {
+    if (e->size >= sz) {
+      p = e->base;
+      e->base += sz;
+      e->size -= sz;
+      if (e->size == 0) {
+        *link = e->next;
+        free(e);
+      }
+      return p;
+    }
+  }
+
+  if (s->size - s->top < sz)
+    return NULL;
+  p = s->base + s->top;
+  s->top += sz;
+  return p;
+}
+
+/* take exactly [p, p+sz) of s if none of it is handed out */
+static int space_take_at(mem_space *s, char *p, size_t sz)
+{
+  mem_extent **link, *e, *rest;
+
+  if (p == s->base + s->top) {
+    if (s->size - s->top < sz)
+      return 0;
+    s->top += sz;
+    return 1;
+  }
+
+  for (link = &s->free; (e = *link) != NULL && e->base <= p; link = &e->next) {
+    if (p + sz > e->base + e->size)
+      continue;
+    if (p + sz < e->base + e->size) {
+      /* keep the part after the range */
+      if ((rest = malloc(sizeof(mem_extent))) == NULL) {
+        fprintf(stderr, "malloc failed in space_take_at\n");
+        abort();
+      }
+      rest->base = p + sz;
+      rest->size = e->base + e->size - rest->base;
+      rest->next = e->next;
+      e->next = rest;
+    }
+    e->size = p - e->base;
+    if (e->size == 0) {
+      *link = e->next;
+      free(e);
+    }
+    return 1;
+  }
+  return 0;
+}
+
+/* hand [p, p+sz) back to s, merging it with its neighbors and with the
+   untouched space at top */
+static void space_put(mem_space *s, char *p, size_t sz)
+{
+  mem_extent **link, *e, *prev = NULL;
+
+  for (link = &s->free; (e = *link) != NULL && e->base < p; link = &e->next)
+    prev = e;
+
+  if (prev && prev->base + prev->size == p) {
+    prev->size += sz;
+    if (e && p + sz == e->base) {
+      prev->size += e->size;
+      prev->next = e->next;
+      free(e);
+    }
+    e = prev;
+  } else if (e && p + sz == e->base) {
+    e->base = p;
+    e->size += sz;
+  } else {
+    if ((e = malloc(sizeof(mem_extent))) == NULL) {
+      fprintf(stderr, "malloc failed in space_put\n");
+      abort();
+    }
+    e->base = p;
+    e->size = sz;
+    e->next = *link;
+    *link = e;
+  }
+
+  /* a range ending at top goes back to the untouched space */
+  if (e->base + e->size == s->base + s->top) {
+    s->top = e->base - s->base;
+    for (link = &s->free; *link != e; link = &(*link)->next)
+      ;
+    *link = NULL;
+    free(e);
+  }
+}
+
+/* forget every range of s */
+static void space_clear(mem_space *s)
+{
+  mem_extent *e;
+
+  s->top = 0;
+  while ((e = s->free) != NULL) {
+    s->free = e->next;
+    free(e);
+  }
+}
+
+/* the region holding p, if any */
+static mem_region *region_of(void *p)
+{
+  mem_region *r;
+  for (r = regions; r; r = r->next)
+    if ((char *)p >= r->space.base && (char *)p < r->space.base + r->space.size)
+      return r;
+  return NULL;
+}
+
+/* map a fresh aligned region of at least sz bytes */
+static mem_region *region_new(size_t sz)
+{
+  size_t size = (sz + AHUGE_SIZE - 1) & ~(size_t)(AHUGE_SIZE - 1);
+  char *p, *base;
+
+  if (size < MEM_REGION_SIZE)
+    size = MEM_REGION_SIZE;
+  mem_region *r;
+
+  /* over-map by a huge page and trim to alignment */
+  p = mmap_or_die(size + AHUGE_SIZE);
+  base = (char *)(((uintptr_t)p + AHUGE_SIZE - 1) & ~(uintptr_t)(AHUGE_SIZE - 1));
+  if (base > p)
+    munmap(p, base - p);
+  munmap(base + size, p + AHUGE_SIZE - base);
+  madvise(base, size, REGION_ADVICE); /* only a hint: THP may be off */
+
+  if ((r = malloc(sizeof(mem_region))) == NULL) {
+    fprintf(stderr, "malloc failed in region_new\n");
+    abort();
+  }
+  r->space.base = base;
+  r->space.size = size;
+  r->space.top = 0;
+  r->space.free = NULL;
+  r->live = 0;
+  r->next = regions;
+  regions = r;
+  return r;
+}
+
+/* carve sz bytes out of the first region with room, newest first,
+   starting a new region if none has any */
+static void *region_carve(size_t sz)
+{
+  mem_region *r;
+  void *p = NULL;
+
+  for (r = regions; r; r = r->next)
+    if ((p = space_take(&r->space, sz)) != NULL)
+      break;
+  if (!r) {
+    r = region_new(sz);
+    p = space_take(&r->space, sz);
+  }
+  r->live += sz;
+  return p;
+}
+
+/* move the contents of [p, p+sz) to q. A large range has its pages
+   moved rather than copied, and fresh pages mapped in their place; that
+   splits at most the huge pages at the ends of either range. */
+static void region_move(char *q, char *p, size_t sz)
+{
+  if (sz < MEM_MOVE_MIN
+      || mremap(p, sz, sz, MREMAP_MAYMOVE | MREMAP_FIXED, q) == MAP_FAILED) {
+    /* small, or [p, p+sz) spans mappings the kernel cannot move as one */
+    memcpy(q, p, sz);
+    return;
+  }
+  if (mmap(p, sz, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANON | MAP_FIXED, -1, 0) == MAP_FAILED) {
+    fprintf(stderr, "mmap failed: %s (%d)\n",
+            strerror(errno), errno);
+    abort();
+  }
+  madvise(p, sz, REGION_ADVICE);
+}
+
+/* give [p, p+sz) back to r. Once nothing is left, r is unmapped, or,
+   if it is the newest region, kept to be carved again rather than
+   remapped. */
+static void region_release(mem_region *r, char *p, size_t sz)
+{
+  mem_region **link;
+
+  space_put(&r->space, p, sz);
+  r->live -= sz;
+  if (r->live > 0 || r == regions)
+    return;
+
+  if (munmap(r->space.base, r->space.size) < 0) {
+    fprintf(stderr, "munmap failed: %s (%d)\n",
+            strerror(errno), errno);
+    abort();
+  }
+  for (link = &regions; *link != r; link = &(*link)->next)
+    ;
+  *link = r->next;
+  space_clear(&r->space);
+  free(r);
+}
+
+/*
+ * mem_set_reserve - serve mem_map by committing pages of one reserved
+ *     range (on != 0) or with separate mappings. Only allowed while
+ *     nothing is mapped; turning it off gives the reservation back.
+ */
+void mem_set_reserve(int on)
+{
+  if (page_count) {
+    fprintf(stderr, "mem_set_reserve: pages are still mapped\n");
+    abort();
+  }
+  use_reserve = on;
+  if (on) {
+    use_huge = MEM_HUGE_OFF;
+  } else if (reserve.base) {
+    reserve_clear();
+    munmap(reserve.base, MEM_RESERVE_SIZE);
+    reserve.base = NULL;
+  }
+}
+
+int mem_reserve(void)
+{
+  return use_reserve;
+}
+
+/* make sure [p, p+sz) is accessible, committing whole MEM_COMMIT_STEPs
+   past commit_top */
+static void commit(char *p, size_t sz)
+{
+  size_t end = p + sz - reserve.base;
+
+  if (end <= commit_top)
+    return;
+  end = (end + MEM_COMMIT_STEP - 1) & ~(size_t)(MEM_COMMIT_STEP - 1);
+  if (end > MEM_RESERVE_SIZE)
+    end = MEM_RESERVE_SIZE;
+  if (mprotect(reserve.base + commit_top, end - commit_top,
+               PROT_READ | PROT_WRITE) < 0) {
+    fprintf(stderr, "mprotect failed: %s (%d)\n",
+            strerror(errno), errno);
+    abort();
+  }
+  commit_top = end;
+}
+
+/* drop the contents of [p, p+sz) */
+static void purge(char *p, size_t sz)
+{
+  if (sz && madvise(p, sz, MADV_DONTNEED) < 0) {
+    fprintf(stderr, "madvise failed: %s (%d)\n",
+            strerror(errno), errno);
+    abort();
+  }
+}
+
+/* take sz bytes of reserved address space, reserving it first if need be */
+static void *reserve_take(size_t sz)
+{
+  char *p;
+
+  if (!reserve.base) {
+    reserve.base = mmap(0, MEM_RESERVE_SIZE, PROT_NONE,
+                        MAP_PRIVATE | MAP_ANON | MAP_NORESERVE, -1, 0);
+    if (reserve.base == MAP_FAILED) {
+      fprintf(stderr, "reserving address space failed: %s (%d)\n",
+              strerror(errno), errno);
+      abort();
+    }
+  }
+
+  if ((p = space_take(&reserve, sz)) == NULL) {
+    fprintf(stderr, "reserved address space exhausted\n");
+    abort();
+  }
+  return p;
+}
+
+/* give back [p, p+sz), and once enough has been given back since the
+   last time, drop the contents of every unmapped committed page */
+static void reserve_release(char *p, size_t sz)
+{
+  mem_extent *e;
+
+  space_put(&reserve, p, sz);
+  purge_bytes += sz;
+  if (purge_bytes < MEM_PURGE_BYTES)
+    return;
+  for (e = reserve.free; e; e = e->next)
+    purge(e->base, e->size);
+  purge(reserve.base + reserve.top, commit_top - reserve.top);
+  purge_bytes = 0;
+}
+
+/* decommit everything and forget all ranges, keeping the reservation */
+static void reserve_clear(void)
+{
+  if (reserve.base && commit_top) {
+    purge(reserve.base, commit_top);
+    if (mprotect(reserve.base, commit_top, PROT_NONE) < 0) {
+      fprintf(stderr, "mprotect failed: %s (%d)\n",
+              strerror(errno), errno);
+      abort();
+    }
+  }
+  space_clear(&reserve);
+  commit_top = 0;
+  purge_bytes = 0;
 }
 
 /*
@@ -58,6 +566,11 @@ size_t mem_pagesize()
   return APAGE_SIZE;
 }
 
+size_t mem_hugepagesize()
+{
+  return AHUGE_SIZE;
+}
+
 size_t mem_heapsize(void)
 {
   return APAGE_SIZE * page_count;
@@ -67,7 +580,6 @@ size_t mem_heapsize(void)
 void *mem_map(size_t sz)
 {
   void *p;
-  size_t i;
   
   if (sz & (APAGE_SIZE - 1)) {
     fprintf(stderr, "mem_map: requested size is not a multiple of %d: %ld\n",
@@ -75,59 +587,309 @@ void *mem_map(size_t sz)
     abort();
   }
 
-  activity_counter++;
-  if ((activity_counter & (activity_counter - 1)) == 0) {
-    /* allocate a page to ensure that mem_map results are not
-       always sequential */
-    mmap(0, APAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+  pthread_mutex_lock(&mem_lock);
+  if (sz / APAGE_SIZE <= MEM_CACHE_PAGES && cache_bins[sz / APAGE_SIZE]) {
+    p = cache_bins[sz / APAGE_SIZE];
+    cache_bins[sz / APAGE_SIZE] = *(void **)p;
+    cache_bytes -= sz;
+    pthread_mutex_unlock(&mem_lock);
+    return p;
   }
 
-  p = mmap(0, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
-  if (p == MAP_FAILED) {
-    fprintf(stderr, "mmap failed: %s (%d)\n",
-            strerror(errno), errno);
-    abort();
+  if (use_huge) {
+    p = region_carve(sz);
+  } else if (use_reserve) {
+    /* no activity_counter spacer: the reservation is private to us */
+    p = reserve_take(sz);
+    commit(p, sz);
+  } else {
+    activity_counter++;
+    if ((activity_counter & (activity_counter - 1)) == 0) {
+      /* allocate a page to ensure that mem_map results are not
+         always sequential */
+      void *spacer = mmap(0, APAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+      if (spacer != MAP_FAILED) {
+        *(void **)spacer = spacers;
+        spacers = spacer;
+      }
+    }
+    p = mmap_or_die(sz);
   }
 
-  for (i = 0; i < sz; i += APAGE_SIZE) {
-    pagemap_modify(p + i, 1);
-    page_count++;
-  }
+  pagemap_modify_range(p, sz, 1);
+  page_count += sz / APAGE_SIZE;
+  pthread_mutex_unlock(&mem_lock);
   
   return p;
 }
 
-void mem_unmap(void *p, size_t sz)
+/*
+ * mem_extend - map sz bytes starting exactly at p, normally the end of
+ *     an existing mapping, so that mapping can grow in place. Returns 0
+ *     and maps nothing if any of those pages are already taken.
+ */
+int mem_extend(void *p, size_t sz)
 {
-  size_t i;
-  
+  void *q;
+
   if (((uintptr_t)p) & (APAGE_SIZE - 1)) {
-    fprintf(stderr, "mem_unmap: given address is not page-aligned: %p\n",
+    fprintf(stderr, "mem_extend: given address is not page-aligned: %p\n",
             p);
     abort();
   }
 
   if (sz & (APAGE_SIZE - 1)) {
-    fprintf(stderr, "mem_unmap: given size is not a multiple of %d: %ld\n",
+    fprintf(stderr, "mem_extend: requested size is not a multiple of %d: %ld\n",
             APAGE_SIZE, sz);
     abort();
   }
-  
-  for (i = 0; i < sz; i += APAGE_SIZE) {
-    if (!pagemap_is_mapped(p+i)) {
-      fprintf(stderr, "mem_unmap: given page is not mapped: %p (in %p:%p)\n",
-              p + i, p, p + sz);
+
+  if (use_huge) {
+    /* a mapping never spans two regions, so the pages before p must be
+       in the same one */
+    mem_region *r;
+
+    pthread_mutex_lock(&mem_lock);
+    r = region_of(p);
+    if (!r || (char *)p == r->space.base || !space_take_at(&r->space, p, sz)) {
+      pthread_mutex_unlock(&mem_lock);
+      return 0;
+    }
+    r->live += sz;
+    pagemap_modify_range(p, sz, 1);
+    page_count += sz / APAGE_SIZE;
+    pthread_mutex_unlock(&mem_lock);
+    return 1;
+  }
+
+  if (use_reserve) {
+    pthread_mutex_lock(&mem_lock);
+    if (!reserve.base || !space_take_at(&reserve, p, sz)) {
+      pthread_mutex_unlock(&mem_lock);
+      return 0;
+    }
+    commit(p, sz);
+    pagemap_modify_range(p, sz, 1);
+    page_count += sz / APAGE_SIZE;
+    pthread_mutex_unlock(&mem_lock);
+    return 1;
+  }
+
+  q = mmap(p, sz, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANON | MAP_FIXED_NOREPLACE, -1, 0);
+  if (q == MAP_FAILED)
+    return 0;
+  if (q != p) {
+    /* the kernel treated the address as a hint and put the pages elsewhere */
+    if (munmap(q, sz) < 0) {
+      fprintf(stderr, "munmap failed: %s (%d)\n",
+              strerror(errno), errno);
       abort();
-    }      
+    }
+    return 0;
+  }
+
+  pthread_mutex_lock(&mem_lock);
+  pagemap_modify_range(p, sz, 1);
+  page_count += sz / APAGE_SIZE;
+  pthread_mutex_unlock(&mem_lock);
 
-    pagemap_modify(p + i, 0);
-    
-    --page_count;
+  return 1;
+}
+
+/*
+ * mem_remap - resize the mapping of oldsz bytes at p to newsz bytes,
+ *     moving it if it cannot grow in place. The contents normally move
+ *     with the pages, so nothing is copied; only a range that was built
+ *     from several mappings (e.g. by mem_extend) is copied, since the
+ *     kernel cannot remap across them. Returns the new address.
+ */
+void *mem_remap(void *p, size_t oldsz, size_t newsz)
+{
+  void *q;
+
+  if (((uintptr_t)p) & (APAGE_SIZE - 1)) {
+    fprintf(stderr, "mem_remap: given address is not page-aligned: %p\n",
+            p);
+    abort();
   }
 
-  if (munmap(p, sz) < 0) {
+  if ((oldsz | newsz) & (APAGE_SIZE - 1)) {
+    fprintf(stderr, "mem_remap: given size is not a multiple of %d: %ld -> %ld\n",
+            APAGE_SIZE, oldsz, newsz);
+    abort();
+  }
+
+  pthread_mutex_lock(&mem_lock);
+  if (!pagemap_is_mapped_range(p, oldsz)) {
+    fprintf(stderr, "mem_remap: given range is not mapped: %p:%p\n",
+            p, p + oldsz);
+    abort();
+  }
+
+  if (use_huge) {
+    /* mremap would split the region's huge pages: shrink or grow in
+       place when the pages after p are free, else carve a new range
+       and copy */
+    mem_region *r = region_of(p);
+    q = p;
+    if (newsz < oldsz) {
+      region_release(r, p + newsz, oldsz - newsz);
+    } else if (newsz > oldsz && !space_take_at(&r->space, p + oldsz, newsz - oldsz)) {
+      q = region_carve(newsz);
+      region_move(q, p, oldsz);
+      region_release(r, p, oldsz);
+    } else if (newsz > oldsz) {
+      r->live += newsz - oldsz;
+    }
+  } else if (use_reserve) {
+    /* shrink or grow in place when the pages after p are free, else
+       commit a new range and copy */
+    q = p;
+    if (newsz < oldsz) {
+      reserve_release(p + newsz, oldsz - newsz);
+    } else if (newsz > oldsz && !space_take_at(&reserve, p + oldsz, newsz - oldsz)) {
+      q = reserve_take(newsz);
+      commit(q, newsz);
+      memcpy(q, p, oldsz);
+      reserve_release(p, oldsz);
+    } else if (newsz > oldsz) {
+      commit(p + oldsz, newsz - oldsz);
+    }
+  } else {
+    q = mremap(p, oldsz, newsz, MREMAP_MAYMOVE);
+  }
+  if (q == MAP_FAILED && errno == EFAULT) {
+    q = mmap(0, newsz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (q != MAP_FAILED) {
+      memcpy(q, p, (oldsz < newsz) ? oldsz : newsz);
+      if (munmap(p, oldsz) < 0) {
+        fprintf(stderr, "munmap failed: %s (%d)\n",
+                strerror(errno), errno);
+        abort();
+      }
+    }
+  }
+  if (q == MAP_FAILED) {
+    fprintf(stderr, "mremap failed: %s (%d)\n",
+            strerror(errno), errno);
+    abort();
+  }
+
+  pagemap_modify_range(p, oldsz, 0);
+  pagemap_modify_range(q, newsz, 1);
+  page_count += newsz / APAGE_SIZE - oldsz / APAGE_SIZE;
+  pthread_mutex_unlock(&mem_lock);
+
+  return q;
+}
+
+/* unmap [p, p+sz) for real; caller holds mem_lock */
+static void release(void *p, size_t sz)
+{
+  if (!pagemap_is_mapped_range(p, sz)) {
+    fprintf(stderr, "mem_unmap: given range is not mapped: %p:%p\n",
+            p, p + sz);
+    abort();
+  }
+  pagemap_modify_range(p, sz, 0);
+  page_count -= sz / APAGE_SIZE;
+
+  if (use_huge) {
+    region_release(region_of(p), p, sz);
+  } else if (use_reserve) {
+    reserve_release(p, sz);
+  } else if (munmap(p, sz) < 0) {
     fprintf(stderr, "munmap failed: %s (%d)\n",
             strerror(errno), errno);
     abort();
   }
 }
+
+/* park [p, p+sz) in the page cache if it fits there; caller holds mem_lock */
+static int cache_put(void *p, size_t sz)
+{
+  size_t n = sz / APAGE_SIZE, m;
+  char *q;
+
+  if (n > MEM_CACHE_PAGES || cache_bytes + sz > cache_max)
+    return 0;
+
+  if (!pagemap_is_mapped_range(p, sz)) {
+    fprintf(stderr, "mem_unmap: given range is not mapped: %p:%p\n",
+            p, p + sz);
+    abort();
+  }
+
+  /* parked pages are still mapped, so check for them separately */
+  for (m = 1; m <= MEM_CACHE_PAGES; m++) {
+    for (q = cache_bins[m]; q; q = *(void **)q) {
+      if (q < (char *)p + sz && (char *)p < q + m * APAGE_SIZE) {
+        fprintf(stderr, "mem_unmap: given range is already unmapped: %p:%p\n",
+                p, p + sz);
+        abort();
+      }
+    }
+  }
+
+  *(void **)p = cache_bins[n];
+  cache_bins[n] = p;
+  cache_bytes += sz;
+  return 1;
+}
+
+void mem_unmap(void *p, size_t sz)
+{
+  if (((uintptr_t)p) & (APAGE_SIZE - 1)) {
+    fprintf(stderr, "mem_unmap: given address is not page-aligned: %p\n",
+            p);
+    abort();
+  }
+
+  if (sz & (APAGE_SIZE - 1)) {
+    fprintf(stderr, "mem_unmap: given size is not a multiple of %d: %ld\n",
+            APAGE_SIZE, sz);
+    abort();
+  }
+  
+  pthread_mutex_lock(&mem_lock);
+  if (!cache_put(p, sz))
+    release(p, sz);
+  pthread_mutex_unlock(&mem_lock);
+}
+
+/*
+ * mem_trim - release parked pages, largest runs first, until at most
+ *     keep bytes are left in the page cache
+ */
+void mem_trim(size_t keep)
+{
+  size_t n;
+  void *p;
+
+  pthread_mutex_lock(&mem_lock);
+  for (n = MEM_CACHE_PAGES; n > 0 && cache_bytes > keep; n--) {
+    while (cache_bins[n] && cache_bytes > keep) {
+      p = cache_bins[n];
+      cache_bins[n] = *(void **)p;
+      cache_bytes -= n * APAGE_SIZE;
+      release(p, n * APAGE_SIZE);
+    }
+  }
+  pthread_mutex_unlock(&mem_lock);
+}
+
+/*
+ * mem_set_cache - park at most max bytes of unmapped pages for reuse
+ *     (0 turns the page cache off), trimming it down if needed
+ */
+void mem_set_cache(size_t max)
+{
+  cache_max = max;
+  mem_trim(max);
+}
+
+size_t mem_cachesize(void)
+{
+  return cache_bytes;
+}
@@ -1,10 +1,25 @@
 #include <unistd.h>
 
+/* mem_set_huge modes */
+#define MEM_HUGE_OFF   0 /* plain page mappings */
+#define MEM_HUGE_ON    1 /* carved from regions backed by huge pages */
+#define MEM_HUGE_SMALL 2 /* carved from the same regions on base pages */
+
 void mem_init(void);               
 void mem_reset(void);
+void mem_set_huge(int);
+int mem_huge(void);
+void mem_set_reserve(int);
+int mem_reserve(void);
 
 size_t mem_pagesize(void);
+size_t mem_hugepagesize(void);
 void *mem_map(size_t);
+int mem_extend(void *, size_t);
+void *mem_remap(void *, size_t, size_t);
 void mem_unmap(void *, size_t);
+void mem_trim(size_t);
+void mem_set_cache(size_t);
+size_t mem_cachesize(void);
 
 size_t mem_heapsize(void);
@@ -4,6 +4,7 @@
 #include <unistd.h>
 #include <assert.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "mm.h"
 #include "memlib.h"
@@ -12,56 +13,287 @@
 
 #define ALIGNMENT 16
 #define ALIGN(sz) (((sz) + (ALIGNMENT-1)) & ~(ALIGNMENT-1))
-#define HDRSIZE ALIGN(sizeof(header_t))   // header aligned to 16 bytes
-#define FDRSIZE ALIGN(sizeof(footer_t))   // footer aligned to 16 bytes
-#define PAGEHDRSIZE ALIGN(sizeof(page_chunk_t))
-#define MIN_BLOCK_SIZE 32                 // minimum block size for free block header and prev/next pointer
+#define HDRSIZE sizeof(header_t)          // 8-byte header word: size | flags
+#define FDRSIZE sizeof(footer_t)          // 8-byte footer, present on free blocks only
+#define PAGEHDRSIZE sizeof(page_chunk_t)
+/* Offset of a chunk's first header: the page header plus padding that
+   puts the first payload on an ALIGNMENT boundary */
+#define FIRST_BLOCK_OFFSET (ALIGN(PAGEHDRSIZE + HDRSIZE) - HDRSIZE)
+#define CHUNK_OVERHEAD (FIRST_BLOCK_OFFSET + HDRSIZE) // page header + padding + epilogue header
+#define MIN_BLOCK_SIZE 32                 // header + prev/next pointers + footer of a free block
+#define NUM_SIZE_CLASSES 4                // segregated free lists, one per power-of-two block size
+#define MIN_CLASS_SHIFT 6                 // class 0 holds blocks smaller than 1 << (MIN_CLASS_SHIFT + 1)
+#define TREE_MIN_SIZE (1UL << (MIN_CLASS_SHIFT + NUM_SIZE_CLASSES)) // larger free blocks live in the size tree
+
+/* Release policy for chunks that become entirely free. Up to
+   RETAIN_FREE_CHUNKS such chunks of at most RETAIN_MAX_BYTES each stay
+   mapped so a free/malloc cycle around a chunk boundary does not
+   mem_unmap and mem_map the same pages every time; anything beyond that
+   goes straight back to memlib. Override either with -D. */
+#ifndef RETAIN_FREE_CHUNKS
+#define RETAIN_FREE_CHUNKS 1
+#endif
+#ifndef RETAIN_MAX_BYTES
+#define RETAIN_MAX_BYTES 4096
+#endif
+
+/* Requests of at most SLAB_MAX_SIZE bytes are served from slab runs: a
+   page carved into equal slots of one ALIGNMENT-multiple size, with no
+   per-slot header. The slab map finds runs in up to SLAB_MAP_SPANS
+   2 MiB spans of address space; past that, small requests fall back to
+   the general heap. */
+#ifndef SLAB_MAX_SIZE
+#define SLAB_MAX_SIZE 64
+#endif
+#define NUM_SLAB_CLASSES (SLAB_MAX_SIZE / ALIGNMENT)
+#ifndef SLAB_MAP_SPANS
+#define SLAB_MAP_SPANS 1024               // a power of two
+#endif
+
+/* Requests of at least LARGE_THRESHOLD bytes get a mapping of their own
+   (see large_malloc) instead of a block in a shared chunk. */
+#ifndef LARGE_THRESHOLD
+#define LARGE_THRESHOLD (64 * 1024)
+#endif
+
+/* Placement policy used by find_fit when nothing else is requested, and
+   how many fitting blocks MM_BEST_FIT examines before settling. */
+#ifndef MM_FIT_POLICY
+#define MM_FIT_POLICY MM_FIRST_FIT
+#endif
+#ifndef BEST_FIT_PROBES
+#define BEST_FIT_PROBES 16
+#endif
+
+/* Per-thread caching (see Thread Caches): how many threads get a cache,
+   the largest general block size a cache keeps, and how many blocks of
+   one size it keeps before returning half of them to the heap. */
+#ifndef MM_MAX_THREADS
+#define MM_MAX_THREADS 64
+#endif
+#ifndef TCACHE_MAX_SIZE
+#define TCACHE_MAX_SIZE 256
+#endif
+#ifndef TCACHE_BIN_MAX
+#define TCACHE_BIN_MAX 4
+#endif
+#define NUM_TCACHE_BINS (TCACHE_MAX_SIZE / ALIGNMENT)
+
+/* mm_free_batch sorts the general blocks it is given this many at a time */
+#ifndef FREE_BATCH_SORT
+#define FREE_BATCH_SORT 128
+#endif
+
+/* An arena region that fills up grows by as much as it already holds,
+   but by no more than ARENA_MAX_GROWTH bytes at a time. */
+#ifndef ARENA_MAX_GROWTH
+#define ARENA_MAX_GROWTH (64 * 1024)
+#endif
 
 /* ---------------- Block Header ---------------- */
 
+/* Block sizes are multiples of ALIGNMENT, so the low bits of the size word
+   carry flags. Allocated blocks are just [header][payload]; free blocks
+   also keep a footer (a copy of the size) in their last word, which is
+   only read when the following block's PREV_ALLOC bit says it exists. */
 typedef struct header {
-    size_t size;       // total size of the block including header and footer
-    int allocated;     // 0 = free, 1 = allocated
-    int padding;
+    size_t info;       // total block size | ALLOC_BIT | PREV_ALLOC_BIT | FIRST_BIT | LARGE_BIT
 } header_t;
 
 typedef struct footer {
-    size_t size;       // block size (header + payload + footer)
-    size_t padding;
+    size_t size;       // total block size
 } footer_t;
 
+#define ALLOC_BIT      0x1UL   // this block is allocated
+#define PREV_ALLOC_BIT 0x2UL   // the block before this one is allocated (or absent)
+#define FIRST_BIT      0x4UL   // this block starts its chunk
+#define LARGE_BIT      0x8UL   // this block is a direct mapping; its size is the mapping's
+#define FLAG_MASK      0xFUL
+
 typedef struct page_chunk {
     struct page_chunk *prev_chunk;
     struct page_chunk *next_chunk;
-    size_t page_size;
-    void *page_end;
 } page_chunk_t;
 
+/* Each mapped chunk is laid out as
+       [page_chunk_t][padding][blocks ...][epilogue header]
+   The first block carries FIRST_BIT and PREV_ALLOC_BIT, and the epilogue
+   header has size 0 and is marked allocated, so neighbor lookups stop at
+   the chunk edges by reading the boundary tags alone instead of searching
+   for the chunk.
+   The chunk's size is not stored: a chunk can grow in place at its tail
+   (see extend_chunk), and an entirely free chunk's size follows from its
+   single block. */
 static page_chunk_t *page_list_head = NULL;
+static int retained_chunks = 0;   // entirely free chunks kept mapped by the release policy
 
 /* Free block prev/next pointers stored in payload */
 #define FREE_PREV_PTR(bp) (*(void **)(bp))
 #define FREE_NEXT_PTR(bp) (*(void **)((char *)(bp) + sizeof(void *)))
 
 /* macros */
-#define GET_ALLOC(h) ((h)->allocated)
-#define SET_ALLOC(h) ((h)->allocated = 1)
-#define SET_FREE(h)  ((h)->allocated = 0)
-#define BLOCK_SIZE(h) ((h)->size)            // total block size including header and footer
-#define PAYLOAD_SIZE(h) ((h)->size - HDRSIZE - FDRSIZE)
-#define FOOTER_MAGIC 0xF00DF00DUL
-
-/* ---------------- Global Free List ---------------- */
-static void *free_list_head = NULL;
+#define PACK(size, flags) ((size) | (flags))
+#define GET_ALLOC(h) ((h)->info & ALLOC_BIT)
+#define SET_ALLOC(h) ((h)->info |= ALLOC_BIT)
+#define SET_FREE(h)  ((h)->info &= ~ALLOC_BIT)
+#define GET_PREV_ALLOC(h) ((h)->info & PREV_ALLOC_BIT)
+#define IS_FIRST(h) ((h)->info & FIRST_BIT)
+#define IS_LARGE(h) ((h)->info & LARGE_BIT)
+#define BLOCK_SIZE(h) ((h)->info & ~FLAG_MASK)   // total block size including header
+#define SET_SIZE(h, sz) ((h)->info = (sz) | ((h)->info & FLAG_MASK))
+#define PAYLOAD_SIZE(h) (BLOCK_SIZE(h) - HDRSIZE)
+#define NEXT_HDR(h) ((header_t *)((char *)(h) + BLOCK_SIZE(h)))  // next header, may be the epilogue
+
+/* ---------------- Segregated Free Lists ---------------- */
+/* free_lists[i] holds free blocks whose total size lies in
+   [2^(i + MIN_CLASS_SHIFT), 2^(i + MIN_CLASS_SHIFT + 1)), class 0 also
+   taking everything smaller. Blocks of TREE_MIN_SIZE bytes or more are
+   kept in size_tree instead. */
+static void *free_lists[NUM_SIZE_CLASSES];
+
+/* ---------------- Size Tree ---------------- */
+/* Free blocks of at least TREE_MIN_SIZE bytes form a treap ordered by
+   (size, address). The child links reuse the free-list pointer slots, and
+   a node's heap priority is a hash of its address, so a tree node needs
+   no more payload than a list node. Lookups are O(log n) expected. */
+#define TREE_LEFT(bp)  FREE_PREV_PTR(bp)
+#define TREE_RIGHT(bp) FREE_NEXT_PTR(bp)
+
+static void *size_tree = NULL;
+
+/* Placement policy: requested_policy is latched into fit_policy by mm_init,
+   so the free lists never mix orderings. MM_NEXT_FIT resumes each class's
+   search at its rover. The policy applies to the class lists; the size
+   tree always yields the best fit. */
+static int requested_policy = MM_FIT_POLICY;
+static int fit_policy = MM_FIT_POLICY;
+static void *rovers[NUM_SIZE_CLASSES];
+
+/* ---------------- Slab Runs ---------------- */
+/* A run is one page: this header, then equal slots up to the page end.
+   Free slots form an intrusive singly linked list through their first
+   word. Every run belongs to one thread cache; runs that still have a
+   free slot sit on their class's slab_partial list in that cache, full
+   runs are on no list until a slot is freed. */
+typedef struct slab_run {
+    struct thread_cache *owner;    // the only cache that allocates from or frees into it
+    struct slab_run *prev_run;
+    struct slab_run *next_run;
+    void *free_slots;
+    unsigned slot_size;            // bytes per slot
+    unsigned used;                 // slots currently allocated
+} slab_run_t;
+
+#define SLAB_HDRSIZE ALIGN(sizeof(slab_run_t))
+
+/* The slab map records which pages are runs, so a pointer is told apart
+   from a general block without reading the heap, which other threads
+   may be writing or unmapping. An entry holds one bit per 4 KiB of a
+   2 MiB-aligned span of address space and is found by open addressing
+   on the span. Once claimed, an entry keeps its span until mm_init, so
+   lookups take no lock; a run's owner sets and clears its bit
+   atomically. */
+#define SLAB_MAP_GRAIN_SHIFT 12           // the smallest page size
+#define SLAB_MAP_SPAN_SHIFT 21
+#define SLAB_MAP_BITS (1 << (SLAB_MAP_SPAN_SHIFT - SLAB_MAP_GRAIN_SHIFT))
+
+typedef struct slab_span {
+    uintptr_t key;                        // span number + 1, 0 while unclaimed
+    uint64_t bits[SLAB_MAP_BITS / 64];
+} slab_span_t;
+
+static slab_span_t slab_map[SLAB_MAP_SPANS];
+
+/* ---------------- Thread Caches ---------------- */
+/* The chunk heap (free lists, size tree, page list, retention and
+   placement state) is shared by all threads and guarded by heap_lock.
+   memlib serializes its own bookkeeping, so slab runs and large blocks
+   never take heap_lock. On top of the heap, each thread owns a cache
+   holding
+     - its slab runs. A slot freed by another thread is pushed on the
+       owner's remote_frees queue without any lock, and the owner takes
+       the whole queue back in one batch at its next mm_malloc.
+     - one bin per block size up to TCACHE_MAX_SIZE of recently freed
+       general blocks. Cached blocks stay marked allocated, so a
+       malloc/free of a common size never takes heap_lock; a bin that
+       overflows returns half of its blocks to the heap in one batch.
+   A general block freed while another thread holds heap_lock is pushed
+   on pending_frees instead of waiting for the lock; whoever next holds
+   the lock, in heap_malloc or after a coalesce, frees the whole batch.
+   Both queues are lock-free multi-producer, single-consumer stacks
+   linked through the first payload word (see mpsc_push). Before
+   queueing, mm_free tells what it was given without heap_lock, so it
+   only reads what no other thread changes or unmaps meanwhile: the
+   slab map, a run's owner (a run holding a live slot stays mapped),
+   and the block's own header through header_info.
+   On thread exit the bins are flushed and the cache, with its slab runs,
+   goes back to the pool for the next new thread to adopt. Threads beyond
+   MM_MAX_THREADS run without a cache and take heap_lock for everything.
+   mm_init resets every cache, so it must not run concurrently with any
+   other call. */
+typedef struct thread_cache {
+    int in_use;                               // claimed by a live thread
+    slab_run_t *slab_partial[NUM_SLAB_CLASSES];
+    void *bins[NUM_TCACHE_BINS];              // cached blocks, linked through their payload
+    unsigned bin_count[NUM_TCACHE_BINS];
+    void *remote_frees;                       // slots freed by other threads (MPSC)
+} thread_cache_t;
+
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static void *pending_frees;                   // blocks freed while heap_lock was busy (MPSC)
+static thread_cache_t caches[MM_MAX_THREADS];
+static unsigned long heap_epoch = 0;          // bumped by mm_init; stale thread caches are dropped
+static __thread thread_cache_t *my_cache;
+static __thread unsigned long my_epoch;
+static pthread_key_t cache_key;               // runs release_thread_cache at thread exit
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+
+/* ---------------- Arenas ---------------- */
+/* An arena bump-allocates out of regions it maps with mem_map, each
+   starting with an arena_region_t; the mm_arena_t itself sits in the
+   first (oldest) region. A full region grows in place with mem_extend
+   when the pages after it are free, so an arena usually stays one region
+   and is released with a single mem_unmap. Arena memory never touches
+   the free lists, slab runs or heap_lock, and an arena must not be used
+   by two threads at once. */
+typedef struct arena_region {
+    struct arena_region *prev;     // next older region, NULL for the first
+    size_t size;                   // mapped bytes, including this header
+} arena_region_t;
+
+struct mm_arena {
+    arena_region_t *regions;       // newest region
+    char *cur;                     // next free byte in the newest region
+    char *end;                     // end of the newest region
+};
+
+#define ARENA_HDRSIZE ALIGN(sizeof(arena_region_t))
 
 /* ---------------- Forward Declarations ---------------- */
 static void insert_free_block(void *bp);
 static void remove_free_block(void *bp);
+static int size_class(size_t block_size);
 static void *find_fit(size_t asize);
+static void tree_insert(void *bp);
+static void tree_remove(void *bp);
+static void *tree_best_fit(size_t asize);
 static void coalesce(void *bp);
 static void split_block(header_t *h, size_t asize);
-static header_t *get_prev_block(header_t *h);
+static void set_next_prev_alloc(header_t *h);
+static header_t *get_prev_free_block(header_t *h);
 static header_t *get_next_block(header_t *h);
+static void release_chunk_if_empty(header_t *h);
+static int extend_chunk(header_t *h, size_t asize);
+static header_t *remap_chunk(header_t *h, size_t asize);
+static slab_run_t *slab_run_of(void *ptr);
+static int slab_mark(slab_run_t *run, int on);
+static void *slab_malloc(thread_cache_t *tc, size_t size);
+static void slab_free(thread_cache_t *tc, slab_run_t *run, void *ptr);
+static thread_cache_t *thread_cache(void);
+static void release_thread_cache(void *arg);
+static void *large_malloc(size_t size);
+static void large_free(header_t *h);
+static void *large_realloc(header_t *h, size_t size);
 
 
 
@@ -70,233 +302,395 @@ static void dump_page_list(void) {
     fprintf(stderr, "DUMP page_list:\n");
     int i = 0;
     while (pc) {
-        fprintf(stderr, "  [%02d] pc=%p prev=%p next=%p page_size=%zu page_end=%p\n",
-                i++, pc, pc->prev_chunk, pc->next_chunk, pc->page_size, pc->page_end);
+        header_t *first = (header_t *)((char *)pc + FIRST_BLOCK_OFFSET);
+        fprintf(stderr, "  [%02d] pc=%p prev=%p next=%p first_size=%zu first_alloc=%d\n",
+                i++, pc, pc->prev_chunk, pc->next_chunk, (size_t)BLOCK_SIZE(first), !!GET_ALLOC(first));
         pc = pc->next_chunk;
     }
 }
+static void dump_size_tree(void *bp, int depth) {
+    if (!bp) return;
+    dump_size_tree(TREE_LEFT(bp), depth + 1);
+    fprintf(stderr, "  %*s bp=%p size=%zu\n", depth * 2, "", bp,
+            (size_t)BLOCK_SIZE((header_t *)((char *)bp - HDRSIZE)));
+    dump_size_tree(TREE_RIGHT(bp), depth + 1);
+}
 static void dump_free_list(void) {
-    void *bp = free_list_head;
-    fprintf(stderr, "DUMP free_list:\n");
-    int i = 0;
-    while (bp) {
-        void *prev = FREE_PREV_PTR(bp);
-        void *next = FREE_NEXT_PTR(bp);
-        header_t *h = (header_t *)((char *)bp - HDRSIZE);
-        fprintf(stderr, "  [%02d] bp=%p header=%p size=%zu alloc=%d prev=%p next=%p\n",
-                i++, bp, h, (size_t)h->size, h->allocated, prev, next);
-        bp = next;
-        if (i > 200) { fprintf(stderr, "  ... free_list too long, stopping dump\n"); break; }
+    fprintf(stderr, "DUMP size_tree:\n");
+    dump_size_tree(size_tree, 0);
+    fprintf(stderr, "DUMP free_lists:\n");
+    for (int c = 0; c < NUM_SIZE_CLASSES; c++) {
+        void *bp = free_lists[c];
+        int i = 0;
+        if (bp) fprintf(stderr, " class %d:\n", c);
+        while (bp) {
+            void *prev = FREE_PREV_PTR(bp);
+            void *next = FREE_NEXT_PTR(bp);
+            header_t *h = (header_t *)((char *)bp - HDRSIZE);
+            fprintf(stderr, "  [%02d] bp=%p header=%p size=%zu alloc=%d prev=%p next=%p\n",
+                    i++, bp, h, (size_t)BLOCK_SIZE(h), !!GET_ALLOC(h), prev, next);
+            bp = next;
+            if (i > 200) { fprintf(stderr, "  ... free list too long, stopping dump\n"); break; }
+        }
     }
 }
 
 
 
-static void check_and_unmap_full_pages() {
-    page_chunk_t *pc = page_list_head;
-
-    while (pc) {
-        // The first block after page header
-        page_chunk_t *next = pc->next_chunk;
-        header_t *h = (header_t *)((char *)pc + PAGEHDRSIZE);
-        size_t page_size = pc->page_size;
-
-        // Only unmap if the block is free and fills the remaining page
-        size_t remaining_size = page_size - PAGEHDRSIZE;
-        if (!GET_ALLOC(h) && BLOCK_SIZE(h) == remaining_size) {
-            // Remove from free list
-            remove_free_block((char *)h + HDRSIZE);
-
-            // Update page list
-            if (pc->prev_chunk)
-                pc->prev_chunk->next_chunk = pc->next_chunk;
-            else
-                page_list_head = pc->next_chunk;
-
-            if (pc->next_chunk)
-                pc->next_chunk->prev_chunk = pc->prev_chunk;
-
-            // Unmap the page
-            // printf("[DEBUG] UNMAP This happen: %p for size: %lu\n\n", pc, pc->page_size);
-
-            mem_unmap(pc, page_size);
-        }
+/* A block spans its whole chunk when it is the chunk's first block and
+   the header after it is the epilogue; the chunk header then sits at a
+   fixed offset in front of it. */
+static inline int block_spans_chunk(header_t *h) {
+    return IS_FIRST(h) && get_next_block(h) == NULL;
+}
 
-        pc = next;
-    }
+static inline page_chunk_t *chunk_of_first_block(header_t *h) {
+    return (page_chunk_t *)((char *)h - FIRST_BLOCK_OFFSET);
 }
 
-static page_chunk_t *find_page_chunk_for_addr(header_t *h) {
-    page_chunk_t *pc = page_list_head;
-    while (pc) {
-        void *page_start = (char *)pc + PAGEHDRSIZE;
-        void *page_end = pc->page_end;
-        if ((void *)h >= page_start && (void *)h < page_end) return pc;
-        pc = pc->next_chunk;
+/* Called on a coalesced free block. If it now covers its entire chunk,
+   either keep the chunk under the retention policy or unmap it. */
+static void release_chunk_if_empty(header_t *h) {
+    if (!block_spans_chunk(h)) return;
+
+    page_chunk_t *pc = chunk_of_first_block(h);
+    size_t page_size = BLOCK_SIZE(h) + CHUNK_OVERHEAD;
+
+    if (retained_chunks < RETAIN_FREE_CHUNKS && page_size <= RETAIN_MAX_BYTES) {
+        retained_chunks++;
+        return;
     }
 
-    return NULL;
+    // Remove from free list
+    remove_free_block((char *)h + HDRSIZE);
+
+    // Update page list
+    if (pc->prev_chunk)
+        pc->prev_chunk->next_chunk = pc->next_chunk;
+    else
+        page_list_head = pc->next_chunk;
+
+    if (pc->next_chunk)
+        pc->next_chunk->prev_chunk = pc->prev_chunk;
+
+    // Unmap the page
+    // printf("[DEBUG] UNMAP This happen: %p for size: %lu\n\n", pc, page_size);
+
+    mem_unmap(pc, page_size);
 }
 
+/* Only free blocks have a footer */
 static inline void write_footer(header_t *h) {
     footer_t *f = (footer_t *)((char *)h + BLOCK_SIZE(h) - FDRSIZE);
-
-    /* optional sanity check: ensure f lies inside a mapped page */
-    page_chunk_t *pc = find_page_chunk_for_addr(h);
-    if (pc) {
-        void *page_start = (char *)pc + PAGEHDRSIZE;
-        void *page_end = pc->page_end;
-        /* Use aligned footer size (FDRSIZE) for bounds checks so checks match pointer arithmetic */
-        if ((void *)f < page_start || (void *)((char *)f + FDRSIZE) > page_end) {
-            fprintf(stderr, "[ERROR] write_footer would write outside page: f=%p page_start=%p page_end=%p\n",
-                    (void*)f, page_start, page_end);
-            abort();
-        }
-    }
-
     f->size = BLOCK_SIZE(h);
 }
 
-/* Return the previous block's header if one exists and is valid.
-   Otherwise return NULL.  This version uses page_chunk bounds checks
-   (via find_page_chunk_for_addr) and does not dereference footers that
-   lie outside the containing mapped page. */
-static header_t *get_prev_block(header_t *h) {
-    page_chunk_t *pc = find_page_chunk_for_addr(h);
-    if (!pc) return NULL;
+/* Copy h's allocation state into the PREV_ALLOC bit of the header after
+   it (possibly the epilogue). Needed whenever h changes state or size.
+   The next block may be allocated and its owner reading its header
+   without heap_lock (see header_info), hence the atomic update. */
+static inline void set_next_prev_alloc(header_t *h) {
+    header_t *next_h = NEXT_HDR(h);
+    if (GET_ALLOC(h))
+        __atomic_fetch_or(&next_h->info, PREV_ALLOC_BIT, __ATOMIC_RELAXED);
+    else
+        __atomic_fetch_and(&next_h->info, ~PREV_ALLOC_BIT, __ATOMIC_RELAXED);
+}
 
-    void *page_start = (char *)pc + PAGEHDRSIZE;
-    void *page_end = pc->page_end;
+/* The header word of an allocated block, read by its owner without
+   heap_lock. Other threads only ever flip its PREV_ALLOC bit, so the
+   size and the other flags read here are stable. */
+static inline size_t header_info(header_t *h) {
+    return __atomic_load_n(&h->info, __ATOMIC_RELAXED);
+}
 
-    /* location of the previous footer (use aligned footer size) */
+/* Return the previous block's header if that block is free, otherwise
+   NULL (it is allocated, so it has no footer to read, or h is the first
+   block of its chunk). */
+static header_t *get_prev_free_block(header_t *h) {
+    if (GET_PREV_ALLOC(h)) return NULL;
     footer_t *prev_f = (footer_t *)((char *)h - FDRSIZE);
+    return (header_t *)((char *)h - prev_f->size);
+}
 
-    /* Ensure the footer pointer lies within the mapped page region */
-    if ((void *)prev_f < page_start || (void *)((char *)prev_f + FDRSIZE) > page_end) {
-        return NULL;
-    }
-
-    size_t prev_size = prev_f->size;
-    if (prev_size < (HDRSIZE + FDRSIZE) || prev_size > (size_t)(page_end - page_start)) {
-        return NULL;
-    }
-
-    header_t *prev_h = (header_t *)((char *)h - prev_size);
+/* Return the next block's header, or NULL if h is the last block of its
+   chunk (the header after it is the size-0 epilogue). */
+static header_t *get_next_block(header_t *h) {
+    header_t *next_h = NEXT_HDR(h);
+    if (BLOCK_SIZE(next_h) == 0) return NULL;
+    return next_h;
+}
 
-    /* Ensure prev_h lies inside this page */
-    if ((void *)prev_h < page_start || (void *)((char *)prev_h + HDRSIZE) > page_end) {
-        return NULL;
-    }
+/* ---------------- Helper: Map a block size to its size class ---------------- */
+static int size_class(size_t block_size) {
+    int msb = (int)(sizeof(size_t) * 8 - 1) - __builtin_clzl(block_size);
+    int c = msb - MIN_CLASS_SHIFT;
+    if (c < 0) return 0;
+    if (c >= NUM_SIZE_CLASSES) return NUM_SIZE_CLASSES - 1;
+    return c;
+}
 
-    return prev_h;
+/* ---------------- Helper: Size tree ---------------- */
+static inline size_t tree_key_size(void *bp) {
+    return BLOCK_SIZE((header_t *)((char *)bp - HDRSIZE));
 }
 
-/* Return the next block's header if one exists and is valid.
-   Uses page_chunk bounds checks to avoid reading footers outside mapped pages. */
-static header_t *get_next_block(header_t *h) {
-    page_chunk_t *pc = find_page_chunk_for_addr(h);
-    if (!pc) return NULL;
+static inline int tree_less(void *a, void *b) {
+    size_t sa = tree_key_size(a), sb = tree_key_size(b);
+    return sa < sb || (sa == sb && a < b);
+}
 
-    void *page_start = (char *)pc + PAGEHDRSIZE;
-    void *page_end = pc->page_end;
+static inline uintptr_t tree_prio(void *bp) {
+    uintptr_t x = (uintptr_t)bp;              // 64-bit mix of the address
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdUL;
+    x ^= x >> 33;
+    return x;
+}
 
-    /* Compute footer position for this block (aligned FDRSIZE) */
-    footer_t *f = (footer_t *)((char *)h + BLOCK_SIZE(h) - FDRSIZE);
+static void *tree_insert_at(void *root, void *bp) {
+    if (!root) {
+        TREE_LEFT(bp) = NULL;
+        TREE_RIGHT(bp) = NULL;
+        return bp;
+    }
+    if (tree_less(bp, root)) {
+        void *l = TREE_LEFT(root) = tree_insert_at(TREE_LEFT(root), bp);
+        if (tree_prio(l) > tree_prio(root)) {          // rotate right
+            TREE_LEFT(root) = TREE_RIGHT(l);
+            TREE_RIGHT(l) = root;
+            return l;
+        }
+    } else {
+        void *r = TREE_RIGHT(root) = tree_insert_at(TREE_RIGHT(root), bp);
+        if (tree_prio(r) > tree_prio(root)) {          // rotate left
+            TREE_RIGHT(root) = TREE_LEFT(r);
+            TREE_LEFT(r) = root;
+            return r;
+        }
+    }
+    return root;
+}
 
-    if ((void *)f < page_start || (void *)((char *)f + FDRSIZE) > page_end) {
-        return NULL;
+/* Join two treaps where every key in a is below every key in b */
+static void *tree_merge(void *a, void *b) {
+    if (!a) return b;
+    if (!b) return a;
+    if (tree_prio(a) > tree_prio(b)) {
+        TREE_RIGHT(a) = tree_merge(TREE_RIGHT(a), b);
+        return a;
     }
+    TREE_LEFT(b) = tree_merge(a, TREE_LEFT(b));
+    return b;
+}
 
-    /* compute the candidate next header */
-    header_t *next_h = (header_t *)((char *)h + BLOCK_SIZE(h));
+static void *tree_remove_at(void *root, void *bp) {
+    if (root == bp)
+        return tree_merge(TREE_LEFT(bp), TREE_RIGHT(bp));
+    if (tree_less(bp, root))
+        TREE_LEFT(root) = tree_remove_at(TREE_LEFT(root), bp);
+    else
+        TREE_RIGHT(root) = tree_remove_at(TREE_RIGHT(root), bp);
+    return root;
+}
 
-    /* Ensure next_h does not walk past the page end */
-    if ((void *)next_h >= page_end) {
-        return NULL;
-    }
+static void tree_insert(void *bp) {
+    size_tree = tree_insert_at(size_tree, bp);
+}
 
-    if ((void *)next_h < page_start || (void *)((char *)next_h + HDRSIZE) > page_end) {
-        return NULL;
-    }
+static void tree_remove(void *bp) {
+    size_tree = tree_remove_at(size_tree, bp);
+    TREE_LEFT(bp) = NULL;
+    TREE_RIGHT(bp) = NULL;
+}
 
-    return next_h;
+/* Smallest block of at least asize bytes, lowest address among equals */
+static void *tree_best_fit(size_t asize) {
+    void *best = NULL;
+    void *bp = size_tree;
+    while (bp) {
+        if (tree_key_size(bp) >= asize) {
+            best = bp;
+            bp = TREE_LEFT(bp);
+        } else {
+            bp = TREE_RIGHT(bp);
+        }
+    }
+    return best;
 }
 
 /* ---------------- Helper: Insert into free list ---------------- */
+/* LIFO at the head of the class, except under MM_ADDRESS_FIT, which keeps
+   each class sorted by address. */
 static void insert_free_block(void *bp) {
-    FREE_PREV_PTR(bp) = NULL;
-    FREE_NEXT_PTR(bp) = free_list_head;
-    if (free_list_head)
-        FREE_PREV_PTR(free_list_head) = bp;
-    free_list_head = bp;
+    header_t *h = (header_t *)((char *)bp - HDRSIZE);
+    if (BLOCK_SIZE(h) >= TREE_MIN_SIZE) {
+        tree_insert(bp);
+        return;
+    }
+
+    void **head = &free_lists[size_class(BLOCK_SIZE(h))];
+    void *prev = NULL;
+    void *next = *head;
+
+    if (fit_policy == MM_ADDRESS_FIT) {
+        while (next && next < bp) {
+            prev = next;
+            next = FREE_NEXT_PTR(next);
+        }
+    }
+
+    FREE_PREV_PTR(bp) = prev;
+    FREE_NEXT_PTR(bp) = next;
+    if (prev)
+        FREE_NEXT_PTR(prev) = bp;
+    else
+        *head = bp;
+    if (next)
+        FREE_PREV_PTR(next) = bp;
 }
 
 /* ---------------- Helper: Remove from free list ---------------- */
+/* The block must still carry the size it was inserted with, so callers
+   remove a block before growing or shrinking it. */
 static void remove_free_block(void *bp) {
+    header_t *h = (header_t *)((char *)bp - HDRSIZE);
+    if (BLOCK_SIZE(h) >= TREE_MIN_SIZE) {
+        tree_remove(bp);
+        return;
+    }
+
+    int c = size_class(BLOCK_SIZE(h));
     void *prev = FREE_PREV_PTR(bp);
     void *next = FREE_NEXT_PTR(bp);
     if (prev)
         FREE_NEXT_PTR(prev) = next;
     else
-        free_list_head = next;
+        free_lists[c] = next;
     if (next)
         FREE_PREV_PTR(next) = prev;
+    if (rovers[c] == bp)
+        rovers[c] = next;
     FREE_PREV_PTR(bp) = NULL;
     FREE_NEXT_PTR(bp) = NULL;
 }
 
-/* ---------------- Helper: Find first-fit free block ---------------- */
+/* ---------------- Helper: Find a fitting free block ---------------- */
+/* First fitting block in [from, to) of one class list */
+static void *first_fit_between(void *from, void *to, size_t asize) {
+    for (void *bp = from; bp != to; bp = FREE_NEXT_PTR(bp)) {
+        header_t *h = (header_t *)((char *)bp - HDRSIZE);
+        if (BLOCK_SIZE(h) >= asize)
+            return bp;
+    }
+    return NULL;
+}
+
+/* Smallest fitting block of class c, giving up after BEST_FIT_PROBES fits */
+static void *best_fit_in_class(int c, size_t asize) {
+    void *best = NULL;
+    size_t best_size = 0;
+    int probes = 0;
+
+    for (void *bp = free_lists[c]; bp && probes < BEST_FIT_PROBES; bp = FREE_NEXT_PTR(bp)) {
+        size_t size = BLOCK_SIZE((header_t *)((char *)bp - HDRSIZE));
+        if (size < asize) continue;
+        if (!best || size < best_size) {
+            best = bp;
+            best_size = size;
+            if (size == asize) break;         // exact fit
+        }
+        probes++;
+    }
+    return best;
+}
+
+/* asize is the total block size needed. Large requests go straight to
+   the size tree. Otherwise only the request's own class can hold blocks
+   that are too small, so it is searched according to the policy; under
+   first and address-ordered fit every block of a larger class fits, so
+   the head of the first non-empty one is taken as is. When the classes
+   have nothing, the smallest block in the tree is used. */
 static void *find_fit(size_t asize) {
-    void *bp = free_list_head;
-    while (bp) {
-        header_t *h = (header_t *)((char *)bp - HDRSIZE); // get the header
-        size_t total_size = HDRSIZE + asize + FDRSIZE;    // total block size needed
-        if (!GET_ALLOC(h) && BLOCK_SIZE(h) >= total_size) {
-            return bp; // return payload pointer
+    if (asize >= TREE_MIN_SIZE) return tree_best_fit(asize);
+
+    int c = size_class(asize);
+    void *bp;
+
+    switch (fit_policy) {
+    case MM_BEST_FIT:
+        for (; c < NUM_SIZE_CLASSES; c++) {
+            if ((bp = best_fit_in_class(c, asize)))
+                return bp;
+        }
+        break;
+
+    case MM_NEXT_FIT:
+        /* Resume at the rover, wrap around to it; the rover then moves
+           past the chosen block when it leaves the list */
+        if (rovers[c]) {
+            bp = first_fit_between(rovers[c], NULL, asize);
+            if (!bp) bp = first_fit_between(free_lists[c], rovers[c], asize);
+        } else {
+            bp = first_fit_between(free_lists[c], NULL, asize);
+        }
+        if (bp) return rovers[c] = bp;
+        for (c = c + 1; c < NUM_SIZE_CLASSES; c++) {
+            if ((bp = rovers[c] ? rovers[c] : free_lists[c]))
+                return rovers[c] = bp;
         }
-        bp = FREE_NEXT_PTR(bp);
+        break;
+
+    default: /* MM_FIRST_FIT, MM_ADDRESS_FIT */
+        if ((bp = first_fit_between(free_lists[c], NULL, asize)))
+            return bp;
+        for (c = c + 1; c < NUM_SIZE_CLASSES; c++) {
+            if (free_lists[c])
+                return free_lists[c];
+        }
+        break;
     }
-    return NULL;
+    return tree_best_fit(asize);
 }
 
 /* ---------------- Helper: Split block if too large ---------------- */
+/* Mark h allocated with a total size of asize, turning what is left over
+   into a free block when it can hold one. */
 static void split_block(header_t *h, size_t asize) {
     size_t block_size = BLOCK_SIZE(h);                 // total size of the block
-    size_t alloc_size = HDRSIZE + asize + FDRSIZE;     // allocated block includes header + payload + footer
-    size_t remaining = block_size - alloc_size;
+    size_t remaining = block_size - asize;
 
-    /* We require space for a properly aligned header + payload(min) + footer in the remaining chunk.
-       Use HDRSIZE/FDRSIZE (aligned) in the check so we know any created free header/footer fit. */
-    if (remaining >= HDRSIZE + MIN_BLOCK_SIZE + FDRSIZE) {
+    if (remaining >= MIN_BLOCK_SIZE) {
         // Shrink the current block to allocated size
-        h->size = alloc_size;
+        SET_SIZE(h, asize);
         SET_ALLOC(h);
-        write_footer(h);
 
         // Create a new free block with remaining space
-        header_t *next_h = (header_t *)((char *)h + alloc_size);
-        next_h->size = remaining;
-        SET_FREE(next_h);
+        header_t *next_h = (header_t *)((char *)h + asize);
+        next_h->info = PACK(remaining, PREV_ALLOC_BIT);
         write_footer(next_h);
+        set_next_prev_alloc(next_h);
 
         insert_free_block((char *)next_h + HDRSIZE);
     } else {
         // Not enough space to split; allocate the whole block
         SET_ALLOC(h);
-        /* ensure footer reflects final size */
-        write_footer(h);
+        set_next_prev_alloc(h);
     }
 }
 
 /* ---------------- Helper: Coalesce adjacent free blocks ---------------- */
+/* bp's header is already marked free; merge it with free neighbors and
+   put the result on a free list. */
 static void coalesce(void *bp) {
     header_t *h = (header_t *)((char *)bp - HDRSIZE);
 
-    header_t *prev_h = get_prev_block(h);
+    header_t *prev_h = get_prev_free_block(h);
     header_t *next_h = get_next_block(h);
 
-    int prev_free = (prev_h && !GET_ALLOC(prev_h));
+    int prev_free = (prev_h != NULL);
     int next_free = (next_h && !GET_ALLOC(next_h));
+    size_t size = BLOCK_SIZE(h);
 
     // printf("[DEBUG] Coalesce: GET_ALLOC prev_free: %d next_free: %d\n",
     //     (prev_free), (next_free));
@@ -304,95 +698,868 @@ static void coalesce(void *bp) {
     /* ---- Perform merges ---- */
     if (prev_free) {
         remove_free_block((char *)prev_h + HDRSIZE);
-        prev_h->size += BLOCK_SIZE(h);
+        size += BLOCK_SIZE(prev_h);
         h = prev_h;
     }
     if (next_free) {
         remove_free_block((char *)next_h + HDRSIZE);
-        h->size += BLOCK_SIZE(next_h);
+        size += BLOCK_SIZE(next_h);
     }
 
+    SET_SIZE(h, size);                    // keeps the leftmost block's PREV_ALLOC/FIRST bits
     write_footer(h);
+    set_next_prev_alloc(h);
 
     insert_free_block((char *)h + HDRSIZE);
 
     /* ---- Check if entire page is free ---- */
-    check_and_unmap_full_pages();
+    release_chunk_if_empty(h);
 }
 
-/* ------------------ mm.c API ------------------ */
-int mm_init(void) {
-    // printf("==== mm_init has been CALLED! Let it BEGIN!!!!!!!! ====\n\n");
-    free_list_head = NULL;
-    page_list_head = NULL;
-    return 0;
+/* ---------------- Helper: Grow a chunk at its tail ---------------- */
+/* h is the last block of its chunk. Map the pages right after the
+   epilogue so h grows to at least asize bytes and move the epilogue to
+   the new end. Fails without changing anything if memlib cannot map at
+   that address. */
+static int extend_chunk(header_t *h, size_t asize) {
+    size_t pagesize = mem_pagesize();
+    char *chunk_end = (char *)h + BLOCK_SIZE(h) + HDRSIZE;   // just past the epilogue
+    size_t grow = ((asize - BLOCK_SIZE(h) + pagesize - 1) / pagesize) * pagesize;
+
+    if (!mem_extend(chunk_end, grow)) return 0;
+
+    SET_SIZE(h, BLOCK_SIZE(h) + grow);                       // absorbs the old epilogue
+    header_t *epilogue = NEXT_HDR(h);
+    epilogue->info = PACK(0, ALLOC_BIT);
+    set_next_prev_alloc(h);
+    return 1;
 }
 
-void *mm_malloc(size_t size) {
-    if (size == 0) return NULL;
+/* ---------------- Helper: Move a single-block chunk ---------------- */
+/* h is allocated and alone in its chunk. Let memlib move the chunk's
+   pages to a larger mapping (no copying) and return h's new header. The
+   block keeps the whole chunk, so later growth stays in place. */
+static header_t *remap_chunk(header_t *h, size_t asize) {
+    size_t pagesize = mem_pagesize();
+    page_chunk_t *pc = chunk_of_first_block(h);
+    size_t old_mapsize = BLOCK_SIZE(h) + CHUNK_OVERHEAD;
+    size_t mapsize = ((asize + CHUNK_OVERHEAD + pagesize - 1) / pagesize) * pagesize;
 
-    size_t asize = ALIGN(size);               // aligned payload size
-    size_t total_size = HDRSIZE + asize + FDRSIZE;
-    void *bp = find_fit(asize);
+    pc = mem_remap(pc, old_mapsize, mapsize);
 
-    if (bp) {
-        // Found a free block
-        header_t *h = (header_t *)((char *)bp - HDRSIZE);
+    // The chunk may have moved, so relink its page list neighbors
+    if (pc->prev_chunk)
+        pc->prev_chunk->next_chunk = pc;
+    else
+        page_list_head = pc;
+    if (pc->next_chunk)
+        pc->next_chunk->prev_chunk = pc;
+
+    h = (header_t *)((char *)pc + FIRST_BLOCK_OFFSET);
+    SET_SIZE(h, mapsize - CHUNK_OVERHEAD);
+    header_t *epilogue = NEXT_HDR(h);
+    epilogue->info = PACK(0, ALLOC_BIT | PREV_ALLOC_BIT);
+    return h;
+}
 
-        remove_free_block(bp);                // remove from free list
+/* ---------------- Helper: Slab runs ---------------- */
+
+/* The slab map entry for p's span, claiming a free one if create is
+   set. NULL if the span has none (and, with create, none is free). */
+static slab_span_t *slab_span_of(void *p, int create) {
+    uintptr_t key = ((uintptr_t)p >> SLAB_MAP_SPAN_SHIFT) + 1;
+    uintptr_t i = (key * 0x9e3779b97f4a7c15UL) >> 32;
+
+    for (unsigned n = 0; n < SLAB_MAP_SPANS; n++, i++) {
+        slab_span_t *s = &slab_map[i & (SLAB_MAP_SPANS - 1)];
+        uintptr_t k = __atomic_load_n(&s->key, __ATOMIC_ACQUIRE);
+        if (k == 0) {
+            if (!create) return NULL;
+            // on failure k is whatever another thread claimed it for
+            if (__atomic_compare_exchange_n(&s->key, &k, key, 0,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+                return s;
+        }
+        if (k == key) return s;
+    }
+    return NULL;
+}
 
-        // printf("[DEBUG] mm_malloc: Found Space at %p, block size=%zu for SIZE=%lu\n\n",
-        //    (void *)((char *)bp - HDRSIZE), BLOCK_SIZE(h), size);
+static inline uint64_t slab_map_bit(slab_run_t *run, size_t *word) {
+    uintptr_t i = ((uintptr_t)run >> SLAB_MAP_GRAIN_SHIFT) & (SLAB_MAP_BITS - 1);
+    *word = i / 64;
+    return (uint64_t)1 << (i % 64);
+}
 
-        /* Let split_block decide whether to split. It will set allocated/footer correctly. */
-        split_block(h, asize);
+/* Return the run holding ptr, or NULL if ptr is a general block */
+static inline slab_run_t *slab_run_of(void *ptr) {
+    slab_run_t *run = (slab_run_t *)((uintptr_t)ptr & ~(uintptr_t)(mem_pagesize() - 1));
+    slab_span_t *s = slab_span_of(run, 0);
+    size_t w;
+    uint64_t bit = slab_map_bit(run, &w);
+    if (!s || !(__atomic_load_n(&s->bits[w], __ATOMIC_ACQUIRE) & bit)) return NULL;
+    return run;
+}
+
+/* Record run's page as a run (on) or no longer one. Recording fails,
+   returning 0, when the slab map has no entry left for its span. */
+static int slab_mark(slab_run_t *run, int on) {
+    slab_span_t *s = slab_span_of(run, on);
+    size_t w;
+    uint64_t bit = slab_map_bit(run, &w);
+    if (!s) return 0;
+    if (on)
+        __atomic_fetch_or(&s->bits[w], bit, __ATOMIC_RELEASE);
+    else
+        __atomic_fetch_and(&s->bits[w], ~bit, __ATOMIC_RELEASE);
+    return 1;
+}
+
+static inline void slab_unlink(thread_cache_t *tc, slab_run_t *run, int cls) {
+    if (run->prev_run)
+        run->prev_run->next_run = run->next_run;
+    else
+        tc->slab_partial[cls] = run->next_run;
+    if (run->next_run)
+        run->next_run->prev_run = run->prev_run;
+}
+
+static inline void slab_push(thread_cache_t *tc, slab_run_t *run, int cls) {
+    run->prev_run = NULL;
+    run->next_run = tc->slab_partial[cls];
+    if (tc->slab_partial[cls])
+        tc->slab_partial[cls]->prev_run = run;
+    tc->slab_partial[cls] = run;
+}
 
-         /* After split_block the header/footer are correct and allocation bit is set */
-        void *payload = (char *)h + HDRSIZE;
+/* Map a new run of tc for class cls and thread all of its slots onto its free list */
+static slab_run_t *new_slab_run(thread_cache_t *tc, int cls) {
+    size_t pagesize = mem_pagesize();
+    slab_run_t *run = mem_map(pagesize);
+    if (!run) return NULL;
+
+    run->owner = tc;
+    run->slot_size = (cls + 1) * ALIGNMENT;
+    run->used = 0;
+    run->free_slots = NULL;
+
+    char *slot = (char *)run + SLAB_HDRSIZE;
+    char *end = (char *)run + pagesize - run->slot_size;
+    void **link = &run->free_slots;
+    for (; slot <= end; slot += run->slot_size) {
+        *link = slot;
+        link = (void **)slot;
+    }
+    *link = NULL;
+
+    if (!slab_mark(run, 1)) {
+        mem_unmap(run, pagesize);
+        return NULL;
+    }
+    slab_push(tc, run, cls);
+    return run;
+}
+
+static void *slab_malloc(thread_cache_t *tc, size_t size) {
+    int cls = ALIGN(size) / ALIGNMENT - 1;
+    slab_run_t *run = tc->slab_partial[cls];
+    if (!run && !(run = new_slab_run(tc, cls))) return NULL;
+
+    void *slot = run->free_slots;
+    run->free_slots = *(void **)slot;
+    run->used++;
+    if (!run->free_slots)
+        slab_unlink(tc, run, cls);            // full: off the partial list
+    return slot;
+}
 
-        return payload;
+/* An empty run is unmapped unless it is its class's only run with free
+   slots, so alloc/free of a single tiny object does not map and unmap a
+   page every time. Only run's owner, tc, may call this. */
+static void slab_free(thread_cache_t *tc, slab_run_t *run, void *ptr) {
+    int cls = run->slot_size / ALIGNMENT - 1;
+    int was_full = (run->free_slots == NULL);
+
+    *(void **)ptr = run->free_slots;
+    run->free_slots = ptr;
+    run->used--;
+
+    if (was_full) {
+        slab_push(tc, run, cls);
+    } else if (run->used == 0 && (run->prev_run || run->next_run)) {
+        slab_unlink(tc, run, cls);
+        slab_mark(run, 0);
+        mem_unmap(run, mem_pagesize());
     }
+}
 
+/* ---------------- Helper: Thread caches ---------------- */
+static void make_cache_key(void) {
+    pthread_key_create(&cache_key, release_thread_cache);
+}
+
+/* The calling thread's cache, claiming a free one from the pool on the
+   thread's first call after mm_init. NULL when every cache is taken. */
+static thread_cache_t *thread_cache(void) {
+    if (my_epoch == heap_epoch) return my_cache;
+
+    pthread_once(&cache_key_once, make_cache_key);
+    thread_cache_t *tc = NULL;
+    pthread_mutex_lock(&heap_lock);
+    for (int i = 0; i < MM_MAX_THREADS; i++) {
+        if (!caches[i].in_use) {
+            tc = &caches[i];
+            tc->in_use = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&heap_lock);
+
+    my_cache = tc;
+    my_epoch = heap_epoch;
+    pthread_setspecific(cache_key, tc);
+    return tc;
+}
+
+/* Push ptr on a queue any thread may push to. The single consumer only
+   ever takes the whole queue at once (mpsc_take_all), so a node is never
+   popped from under a pusher's compare-and-swap and there is no ABA. */
+static inline void mpsc_push(void **queue, void *ptr) {
+    void *head = __atomic_load_n(queue, __ATOMIC_RELAXED);
+    do {
+        *(void **)ptr = head;
+    } while (!__atomic_compare_exchange_n(queue, &head, ptr, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static inline void *mpsc_take_all(void **queue) {
+    if (!__atomic_load_n(queue, __ATOMIC_RELAXED)) return NULL;
+    return __atomic_exchange_n(queue, NULL, __ATOMIC_ACQUIRE);
+}
+
+/* Free every block queued on pending_frees. Caller holds heap_lock. */
+static void drain_pending_frees(void) {
+    void *bp = mpsc_take_all(&pending_frees);
+    while (bp) {
+        void *next = *(void **)bp;
+        SET_FREE((header_t *)((char *)bp - HDRSIZE));
+        coalesce(bp);
+        bp = next;
+    }
+}
+
+/* Free a slot: directly when tc owns its run, otherwise by queueing it
+   for the owner */
+static void slab_release(thread_cache_t *tc, slab_run_t *run, void *ptr) {
+    if (run->owner == tc)
+        slab_free(tc, run, ptr);
+    else
+        mpsc_push(&run->owner->remote_frees, ptr);
+}
+
+/* Take back, in one batch, every slot other threads freed into tc's runs */
+static void drain_remote_frees(thread_cache_t *tc) {
+    void *ptr = mpsc_take_all(&tc->remote_frees);
+    while (ptr) {
+        void *next = *(void **)ptr;
+        slab_free(tc, slab_run_of(ptr), ptr);
+        ptr = next;
+    }
+}
+
+static inline int tcache_bin(size_t block_size) {
+    return block_size / ALIGNMENT - 1;
+}
+
+/* Return all but the keep most recently cached blocks of a bin to the
+   heap, under a single acquisition of heap_lock */
+static void tcache_flush(thread_cache_t *tc, int bin, unsigned keep) {
+    void **link = &tc->bins[bin];
+    for (unsigned i = 0; i < keep && *link; i++)
+        link = (void **)*link;
+    void *bp = *link;
+    *link = NULL;
+    tc->bin_count[bin] = keep < tc->bin_count[bin] ? keep : tc->bin_count[bin];
+
+    pthread_mutex_lock(&heap_lock);
+    while (bp) {
+        void *next = *(void **)bp;
+        SET_FREE((header_t *)((char *)bp - HDRSIZE));
+        coalesce(bp);
+        bp = next;
+    }
+    drain_pending_frees();
+    pthread_mutex_unlock(&heap_lock);
+}
+
+/* Thread exit: hand the cached blocks back to the heap and the cache,
+   slab runs included, back to the pool */
+static void release_thread_cache(void *arg) {
+    thread_cache_t *tc = arg;
+    if (my_epoch != heap_epoch) return;       // mm_init has reset it already
+
+    for (int b = 0; b < NUM_TCACHE_BINS; b++) {
+        if (tc->bins[b])
+            tcache_flush(tc, b, 0);
+    }
+    drain_remote_frees(tc);
+
+    my_cache = NULL;
+    my_epoch = 0;
+    pthread_mutex_lock(&heap_lock);
+    tc->in_use = 0;
+    pthread_mutex_unlock(&heap_lock);
+}
+
+/* ---------------- Helper: Large blocks ---------------- */
+/* A large block is a mapping of exactly the pages it needs:
+       [unused word][header][payload ...]
+   Its header has LARGE_BIT set and records the mapping size, so mm_free
+   unmaps it directly: no coalescing, no free list and no page list. */
+#define LARGE_HDRSIZE ALIGN(HDRSIZE)
+
+static inline size_t large_mapsize(size_t size) {
+    size_t pagesize = mem_pagesize();
+    return ((size + LARGE_HDRSIZE + pagesize - 1) / pagesize) * pagesize;
+}
+
+static void *large_malloc(size_t size) {
+    size_t mapsize = large_mapsize(size);
+    char *region = mem_map(mapsize);
+    if (!region) return NULL;
+
+    header_t *h = (header_t *)(region + LARGE_HDRSIZE - HDRSIZE);
+    h->info = PACK(mapsize, ALLOC_BIT | LARGE_BIT);
+    return region + LARGE_HDRSIZE;
+}
+
+static void large_free(header_t *h) {
+    mem_unmap((char *)h + HDRSIZE - LARGE_HDRSIZE, BLOCK_SIZE(h));
+}
+
+/* Resize by remapping, which moves pages rather than bytes; a block that
+   drops below LARGE_THRESHOLD moves back into the general heap. */
+static void *large_realloc(header_t *h, size_t size) {
+    char *region = (char *)h + HDRSIZE - LARGE_HDRSIZE;
+    size_t old_mapsize = BLOCK_SIZE(h);
+
+    if (size < LARGE_THRESHOLD) {
+        void *newp = mm_malloc(size);
+        if (!newp) return NULL;
+        memcpy(newp, region + LARGE_HDRSIZE, size);
+        large_free(h);
+        return newp;
+    }
+
+    size_t mapsize = large_mapsize(size);
+    if (mapsize != old_mapsize) {
+        region = mem_remap(region, old_mapsize, mapsize);
+        h = (header_t *)(region + LARGE_HDRSIZE - HDRSIZE);
+        h->info = PACK(mapsize, ALLOC_BIT | LARGE_BIT);
+    }
+    return region + LARGE_HDRSIZE;
+}
+
+/* ---------------- Helper: Arenas ---------------- */
+/* Make room for at least size more bytes in arena: grow the newest region
+   in place, or else map a new one. */
+static int arena_grow(mm_arena_t *arena, size_t size) {
+    size_t pagesize = mem_pagesize();
+    arena_region_t *r = arena->regions;
+    size_t grow = r->size < ARENA_MAX_GROWTH ? r->size : ARENA_MAX_GROWTH;
+    size_t need = ((size - (arena->end - arena->cur) + pagesize - 1) / pagesize) * pagesize;
+    if (grow < need) grow = need;
+
+    if (mem_extend(arena->end, grow)) {
+        r->size += grow;
+        arena->end += grow;
+        return 1;
+    }
+
+    /* What was left in the old region is abandoned until reset */
+    need = ((size + ARENA_HDRSIZE + pagesize - 1) / pagesize) * pagesize;
+    if (grow < need) grow = need;
+    arena_region_t *nr = mem_map(grow);
+    if (!nr) return 0;
+    nr->prev = r;
+    nr->size = grow;
+    arena->regions = nr;
+    arena->cur = (char *)nr + ARENA_HDRSIZE;
+    arena->end = (char *)nr + grow;
+    return 1;
+}
+
+/* Unmap every region newer than the first one */
+static void arena_release_newer(mm_arena_t *arena) {
+    arena_region_t *r = arena->regions;
+    while (r->prev) {
+        arena_region_t *prev = r->prev;
+        mem_unmap(r, r->size);
+        r = prev;
+    }
+    arena->regions = r;
+}
+
+/* Total block size (header + aligned payload) for a request */
+static inline size_t adjust_size(size_t size) {
+    size_t asize = ALIGN(size + HDRSIZE);
+    return asize < MIN_BLOCK_SIZE ? MIN_BLOCK_SIZE : asize;
+}
+
+/* ---------------- Helper: Allocate from the chunk heap ---------------- */
+/* heap_find and heap_map return a free block of at least asize bytes,
+   still free and on no list, for split_block or carve_blocks to allocate.
+   heap_find takes it off the free lists, heap_map maps a new chunk for
+   it. Caller holds heap_lock. */
+static header_t *heap_find(size_t asize) {
+    void *bp = find_fit(asize);
+    if (!bp) return NULL;
+
+    // Found a free block
+    header_t *h = (header_t *)((char *)bp - HDRSIZE);
+
+    remove_free_block(bp);                // remove from free list
+
+    /* Reusing a retained empty chunk takes it out of the retention budget */
+    if (block_spans_chunk(h))
+        retained_chunks--;
+
+    return h;
+}
+
+static header_t *heap_map(size_t asize) {
     // Need to map a new page
     size_t pagesize = mem_pagesize();
-    size_t need = total_size + PAGEHDRSIZE;
+    size_t need = asize + CHUNK_OVERHEAD;
     size_t mapsize = ((need + pagesize - 1) / pagesize) * pagesize;
 
     void *region = mem_map(mapsize);
     if (!region) return NULL;
 
-    // printf("[DEBUG] mm_malloc: mapped region at %p, mapsize=%zu for ASIZE=%lu\n",
-    //        region, mapsize, asize);
-
     // Insert page_chunk at start of mapped region
     page_chunk_t *pc = (page_chunk_t *)region;
     pc->prev_chunk = NULL;
     pc->next_chunk = page_list_head;
-    pc->page_size = mapsize;
-    pc->page_end = (char *)region + mapsize;
     if (page_list_head)
         page_list_head->prev_chunk = pc;
     page_list_head = pc;
 
-    // Create a single free block that covers the entire usable page region
-    header_t *h = (header_t *)((char *)region + PAGEHDRSIZE);
-    size_t free_block_size = mapsize - PAGEHDRSIZE;
-
-    h->size = free_block_size;
-    SET_FREE(h);
+    // Create a single free block that covers the entire usable page region,
+    // followed by the epilogue
+    header_t *h = (header_t *)((char *)region + FIRST_BLOCK_OFFSET);
+    h->info = PACK(mapsize - CHUNK_OVERHEAD, PREV_ALLOC_BIT | FIRST_BIT);
     write_footer(h);
+    header_t *epilogue = NEXT_HDR(h);
+    epilogue->info = PACK(0, ALLOC_BIT);
 
-    split_block(h, asize);
+    return h;
+}
+
+/* asize is the total block size. Caller holds heap_lock. */
+static void *heap_malloc(size_t asize) {
+    drain_pending_frees();
+    header_t *h = heap_find(asize);
+    if (!h) h = heap_map(asize);
+    if (!h) return NULL;
 
+    /* Let split_block decide whether to split. It will set the allocation bits correctly. */
+    split_block(h, asize);
     return (char *)h + HDRSIZE;
 }
 
+/* ---------------- Helper: Batches ---------------- */
+/* Cut the free, unlisted block h front to back into as many blocks of
+   asize bytes as it holds, at most n, storing their payloads in ptrs. The
+   last one goes through split_block, which frees what is left over.
+   Returns the number of blocks. Caller holds heap_lock. */
+static size_t carve_blocks(header_t *h, size_t asize, size_t n, void **ptrs) {
+    size_t k = BLOCK_SIZE(h) / asize;
+    if (k > n) k = n;
+
+    size_t rest = BLOCK_SIZE(h);
+    for (size_t i = 0; i + 1 < k; i++) {
+        h->info = PACK(asize, (h->info & (PREV_ALLOC_BIT | FIRST_BIT)) | ALLOC_BIT);
+        ptrs[i] = (char *)h + HDRSIZE;
+        rest -= asize;
+        h = (header_t *)((char *)h + asize);
+        h->info = PACK(rest, PREV_ALLOC_BIT);
+    }
+    split_block(h, asize);
+    ptrs[k - 1] = (char *)h + HDRSIZE;
+    return k;
+}
+
+static int compare_ptrs(const void *a, const void *b) {
+    uintptr_t pa = (uintptr_t)*(void *const *)a, pb = (uintptr_t)*(void *const *)b;
+    return (pa > pb) - (pa < pb);
+}
+
+/* Free k general blocks: sort them by address, merge each run of
+   neighbors into one block, and coalesce that once, so the chunk release
+   check runs once per run rather than once per block. */
+static void heap_free_sorted(void **bps, size_t k) {
+    qsort(bps, k, sizeof(void *), compare_ptrs);
+
+    pthread_mutex_lock(&heap_lock);
+    drain_pending_frees();
+    for (size_t j = 0; j < k; ) {
+        header_t *h = (header_t *)((char *)bps[j] - HDRSIZE);
+        size_t size = BLOCK_SIZE(h);
+        for (j++; j < k && (char *)bps[j] - HDRSIZE == (char *)h + size; j++)
+            size += BLOCK_SIZE((header_t *)((char *)bps[j] - HDRSIZE));
+
+        SET_SIZE(h, size);                    // keeps h's PREV_ALLOC/FIRST bits
+        SET_FREE(h);
+        coalesce((char *)h + HDRSIZE);
+    }
+    pthread_mutex_unlock(&heap_lock);
+}
+
+/* ---------------- Helper: Resize a heap block in place ---------------- */
+/* Return h's payload if h could be resized to asize bytes where it is
+   (possibly by growing or moving its chunk), NULL if it has to move.
+   Caller holds heap_lock. */
+static void *heap_realloc_in_place(header_t *h, size_t asize) {
+    void *ptr = (char *)h + HDRSIZE;
+    size_t old_size = BLOCK_SIZE(h);
+
+    // Shrink in place; a split-off tail is merged with a free next neighbor
+    if (old_size >= asize) {
+        if (old_size - asize >= MIN_BLOCK_SIZE) {
+            SET_SIZE(h, asize);
+
+            header_t *rest = NEXT_HDR(h);
+            rest->info = PACK(old_size - asize, PREV_ALLOC_BIT);
+            coalesce((char *)rest + HDRSIZE);
+        }
+        return ptr;
+    }
+
+    header_t *next_h = get_next_block(h);
+    int next_free = (next_h && !GET_ALLOC(next_h));
+    size_t avail = old_size + (next_free ? BLOCK_SIZE(next_h) : 0);
+    int at_tail = next_free ? get_next_block(next_h) == NULL : next_h == NULL;
+
+    // Grow in place, absorbing the free next neighbor
+    if (next_free && avail >= asize) {
+        remove_free_block((char *)next_h + HDRSIZE);
+        SET_SIZE(h, avail);
+        /* Less than a page left at the chunk's tail stays with the block
+           as slack for its next growth instead of being split off */
+        if (at_tail && avail - asize < mem_pagesize()) {
+            set_next_prev_alloc(h);
+            return ptr;
+        }
+        split_block(h, asize);
+        return ptr;
+    }
+
+    // Block (plus a free neighbor) ends its chunk: grow the chunk itself
+    if (at_tail) {
+        if (next_free) {
+            remove_free_block((char *)next_h + HDRSIZE);
+            SET_SIZE(h, avail);
+            set_next_prev_alloc(h);
+        }
+        if (extend_chunk(h, asize))
+            return ptr;                       // keeps the sub-page tail as slack
+        if (IS_FIRST(h)) {
+            h = remap_chunk(h, asize);
+            return (char *)h + HDRSIZE;
+        }
+    }
+    return NULL;
+}
+
+/* ------------------ mm.c API ------------------ */
+int mm_init(void) {
+    // printf("==== mm_init has been CALLED! Let it BEGIN!!!!!!!! ====\n\n");
+    memset(free_lists, 0, sizeof(free_lists));
+    memset(rovers, 0, sizeof(rovers));
+    size_tree = NULL;
+    memset(slab_map, 0, sizeof(slab_map));
+    fit_policy = requested_policy;
+    page_list_head = NULL;
+    retained_chunks = 0;
+
+    heap_epoch++;
+    for (int i = 0; i < MM_MAX_THREADS; i++) {
+        thread_cache_t *tc = &caches[i];
+        tc->in_use = 0;
+        memset(tc->slab_partial, 0, sizeof(tc->slab_partial));
+        memset(tc->bins, 0, sizeof(tc->bins));
+        memset(tc->bin_count, 0, sizeof(tc->bin_count));
+        tc->remote_frees = NULL;
+    }
+    pending_frees = NULL;
+    return 0;
+}
+
+/* Select the placement policy for the next mm_init */
+void mm_set_fit_policy(int policy) {
+    if (policy >= 0 && policy < MM_NUM_FIT_POLICIES)
+        requested_policy = policy;
+}
+
+int mm_fit_policy(void) {
+    return fit_policy;
+}
+
+const char *mm_fit_policy_name(int policy) {
+    static const char *names[MM_NUM_FIT_POLICIES] = {
+        "first", "next", "best", "address"
+    };
+    return (policy >= 0 && policy < MM_NUM_FIT_POLICIES) ? names[policy] : "?";
+}
+
+void *mm_malloc(size_t size) {
+    if (size == 0) return NULL;
+
+    thread_cache_t *tc = thread_cache();
+    if (tc)
+        drain_remote_frees(tc);
+
+    if (size <= SLAB_MAX_SIZE && tc) {
+        void *slot = slab_malloc(tc, size);
+        if (slot) return slot;                // else the slab map is full
+    }
+    if (size >= LARGE_THRESHOLD) return large_malloc(size);
+
+    size_t asize = adjust_size(size);         // total block size
+    if (tc && asize <= TCACHE_MAX_SIZE && tc->bins[tcache_bin(asize)]) {
+        int b = tcache_bin(asize);
+        void *bp = tc->bins[b];
+        tc->bins[b] = *(void **)bp;
+        tc->bin_count[b]--;
+        return bp;
+    }
+
+    pthread_mutex_lock(&heap_lock);
+    void *bp = heap_malloc(asize);
+    pthread_mutex_unlock(&heap_lock);
+    return bp;
+}
+
 void mm_free(void *ptr) {
     if (!ptr) return;
+
+    thread_cache_t *tc = thread_cache();
+    slab_run_t *run = slab_run_of(ptr);
+    if (run) {
+        slab_release(tc, run, ptr);
+        return;
+    }
+
     header_t *h = (header_t *)((char *)ptr - HDRSIZE);
     // printf("[DEBUG] mm_free called with payload %p header %p\n", ptr, (void*)h);
+    size_t info = header_info(h);
+    if (info & LARGE_BIT) {
+        large_free(h);
+        return;
+    }
+
+    size_t size = info & ~FLAG_MASK;
+    if (tc && size <= TCACHE_MAX_SIZE) {
+        int b = tcache_bin(size);
+        *(void **)ptr = tc->bins[b];
+        tc->bins[b] = ptr;
+        if (++tc->bin_count[b] > TCACHE_BIN_MAX)
+            tcache_flush(tc, b, TCACHE_BIN_MAX / 2);
+        return;
+    }
+
+    /* Never wait for the heap: leave the block to the lock's holder */
+    if (pthread_mutex_trylock(&heap_lock) != 0) {
+        mpsc_push(&pending_frees, ptr);
+        return;
+    }
     SET_FREE(h);
-    /* Update footer so coalesce/get_next_block can safely use this block's footer */
-    write_footer(h);
     coalesce(ptr);
-}
\ No newline at end of file
+    drain_pending_frees();
+    pthread_mutex_unlock(&heap_lock);
+}
+
+void *mm_realloc(void *ptr, size_t size) {
+    if (!ptr) return mm_malloc(size);
+    if (size == 0) {
+        mm_free(ptr);
+        return NULL;
+    }
+
+    // A slab slot stays put while the new size still fits it
+    slab_run_t *run = slab_run_of(ptr);
+    if (run) {
+        if (size <= run->slot_size && size > run->slot_size - ALIGNMENT) return ptr;
+        void *newp = mm_malloc(size);
+        if (!newp) return NULL;
+        memcpy(newp, ptr, size < run->slot_size ? size : run->slot_size);
+        mm_free(ptr);
+        return newp;
+    }
+
+    header_t *h = (header_t *)((char *)ptr - HDRSIZE);
+    if (header_info(h) & LARGE_BIT) return large_realloc(h, size);
+
+    pthread_mutex_lock(&heap_lock);
+    void *newp = heap_realloc_in_place(h, adjust_size(size));
+    pthread_mutex_unlock(&heap_lock);
+    if (newp) return newp;
+
+    // Move the block
+    newp = mm_malloc(size);
+    if (!newp) return NULL;
+    memcpy(newp, ptr, (header_info(h) & ~FLAG_MASK) - HDRSIZE);
+    mm_free(ptr);
+
+    /* A block that outgrew its place tends to keep growing. If it landed in
+       front of a free chunk tail, keep that tail as slack so the next
+       realloc grows in place and the block stays eligible for extend_chunk
+       (or remap_chunk when it is the chunk's only block). */
+    if (slab_run_of(newp)) return newp;
+    header_t *new_h = (header_t *)((char *)newp - HDRSIZE);
+    if (header_info(new_h) & LARGE_BIT) return newp;
+    pthread_mutex_lock(&heap_lock);
+    header_t *next_h = get_next_block(new_h);
+    if (next_h && !GET_ALLOC(next_h) && get_next_block(next_h) == NULL) {
+        remove_free_block((char *)next_h + HDRSIZE);
+        SET_SIZE(new_h, BLOCK_SIZE(new_h) + BLOCK_SIZE(next_h));
+        set_next_prev_alloc(new_h);
+    }
+    pthread_mutex_unlock(&heap_lock);
+    return newp;
+}
+
+/* Allocate n blocks of size bytes into ptrs. Blocks beyond the thread
+   cache are carved front to back out of as few free regions as possible
+   under one acquisition of heap_lock: one region that holds the rest of
+   the batch if there is one, else whatever free blocks fit, and a new
+   chunk sized for what is left only when those run out. Returns n, or 0
+   with nothing allocated if memory runs out. */
+size_t mm_malloc_batch(size_t size, size_t n, void **ptrs) {
+    size_t i = 0;
+    if (size == 0 || n == 0) return 0;
+
+    if (size <= SLAB_MAX_SIZE || size >= LARGE_THRESHOLD) {
+        for (; i < n; i++) {
+            if (!(ptrs[i] = mm_malloc(size)))
+                goto fail;
+        }
+        return n;
+    }
+
+    size_t asize = adjust_size(size);
+    if (n > SIZE_MAX / asize) return 0;
+
+    thread_cache_t *tc = thread_cache();
+    if (tc && asize <= TCACHE_MAX_SIZE) {
+        int b = tcache_bin(asize);
+        for (; i < n && tc->bins[b]; i++) {
+            ptrs[i] = tc->bins[b];
+            tc->bins[b] = *(void **)ptrs[i];
+            tc->bin_count[b]--;
+        }
+    }
+
+    pthread_mutex_lock(&heap_lock);
+    drain_pending_frees();
+    while (i < n) {
+        header_t *h = heap_find((n - i) * asize);
+        if (!h) h = heap_find(asize);
+        if (!h) h = heap_map((n - i) * asize);
+        if (!h) break;
+        i += carve_blocks(h, asize, n - i, ptrs + i);
+    }
+    pthread_mutex_unlock(&heap_lock);
+    if (i == n) return n;
+
+fail:
+    mm_free_batch(ptrs, i);
+    return 0;
+}
+
+/* Free n blocks (NULLs are skipped). General blocks are gathered
+   FREE_BATCH_SORT at a time for heap_free_sorted; ptrs is not modified. */
+void mm_free_batch(void **ptrs, size_t n) {
+    void *bps[FREE_BATCH_SORT];
+    thread_cache_t *tc = thread_cache();
+
+    for (size_t i = 0; i < n; ) {
+        size_t k = 0;
+        for (; i < n && k < FREE_BATCH_SORT; i++) {
+            void *ptr = ptrs[i];
+            if (!ptr) continue;
+
+            slab_run_t *run = slab_run_of(ptr);
+            if (run) {
+                slab_release(tc, run, ptr);
+                continue;
+            }
+            header_t *h = (header_t *)((char *)ptr - HDRSIZE);
+            if (header_info(h) & LARGE_BIT) {
+                large_free(h);
+                continue;
+            }
+            bps[k++] = ptr;
+        }
+        if (k) heap_free_sorted(bps, k);
+    }
+}
+
+/* ------------------ Arena API ------------------ */
+mm_arena_t *mm_arena_create(void) {
+    size_t pagesize = mem_pagesize();
+    arena_region_t *r = mem_map(pagesize);
+    if (!r) return NULL;
+
+    r->prev = NULL;
+    r->size = pagesize;
+    mm_arena_t *arena = (mm_arena_t *)((char *)r + ARENA_HDRSIZE);
+    arena->regions = r;
+    arena->cur = (char *)arena + ALIGN(sizeof(mm_arena_t));
+    arena->end = (char *)r + pagesize;
+    return arena;
+}
+
+void *mm_arena_alloc(mm_arena_t *arena, size_t size) {
+    if (size == 0) return NULL;
+    size = ALIGN(size);
+    if ((size_t)(arena->end - arena->cur) < size && !arena_grow(arena, size))
+        return NULL;
+
+    void *p = arena->cur;
+    arena->cur += size;
+    return p;
+}
+
+/* The newest allocation grows or shrinks where it is, and any other one
+   shrinks where it is; otherwise the block is copied to a new allocation,
+   leaving the old bytes to the next reset */
+void *mm_arena_realloc(mm_arena_t *arena, void *ptr, size_t old_size, size_t size) {
+    if (!ptr) return mm_arena_alloc(arena, size);
+    if (size == 0) return NULL;
+
+    if ((char *)ptr + ALIGN(old_size) == arena->cur &&
+        (size_t)(arena->end - (char *)ptr) >= ALIGN(size)) {
+        arena->cur = (char *)ptr + ALIGN(size);
+        return ptr;
+    }
+    if (size <= old_size) return ptr;
+
+    void *newp = mm_arena_alloc(arena, size);
+    if (!newp) return NULL;
+    memcpy(newp, ptr, old_size < size ? old_size : size);
+    return newp;
+}
+
+/* Free everything allocated from arena, keeping its first region */
+void mm_arena_reset(mm_arena_t *arena) {
+    arena_release_newer(arena);
+    arena->cur = (char *)arena + ALIGN(sizeof(mm_arena_t));
+    arena->end = (char *)arena->regions + arena->regions->size;
+}
+
+void mm_arena_destroy(mm_arena_t *arena) {
+    arena_release_newer(arena);
+    arena_region_t *r = arena->regions;      // arena lives in r: unmap it last
+    mem_unmap(r, r->size);
+}
@@ -3,3 +3,32 @@
 extern int mm_init (void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
+extern void *mm_realloc (void *ptr, size_t size);
+
+/* Allocate or free many blocks in one call. mm_malloc_batch fills ptrs
+   with n blocks of size bytes and returns n, or returns 0 having
+   allocated nothing. */
+extern size_t mm_malloc_batch (size_t size, size_t n, void **ptrs);
+extern void mm_free_batch (void **ptrs, size_t n);
+
+/* Free-block placement policies, selected with mm_set_fit_policy */
+#define MM_FIRST_FIT   0
+#define MM_NEXT_FIT    1
+#define MM_BEST_FIT    2
+#define MM_ADDRESS_FIT 3
+#define MM_NUM_FIT_POLICIES 4
+
+extern void mm_set_fit_policy (int policy);
+extern int mm_fit_policy (void);
+extern const char *mm_fit_policy_name (int policy);
+
+/* Arenas: bump allocation out of a few mappings that are all released
+   at once by mm_arena_reset or mm_arena_destroy. Arena blocks must not
+   be passed to mm_free or mm_realloc. */
+typedef struct mm_arena mm_arena_t;
+
+extern mm_arena_t *mm_arena_create (void);
+extern void *mm_arena_alloc (mm_arena_t *arena, size_t size);
+extern void *mm_arena_realloc (mm_arena_t *arena, void *ptr, size_t old_size, size_t size);
+extern void mm_arena_reset (mm_arena_t *arena);
+extern void mm_arena_destroy (mm_arena_t *arena);
@@ -1,101 +1,202 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <inttypes.h>
 #include "pagemap.h"
 
 /* Keep track of all mapped pages so that we can easily get a list of
-   all of them --- but also efficiently add and remove from the list. */
+   all of them --- but also efficiently add and remove from the list.
 
-typedef struct mpage {
-  void *addr;
-  struct mpage *prev, *next;
-} mpage;
+   The map is a radix tree over the 48-bit address space, four levels of
+   PAGEMAP_BITS bits each, like the hardware's own page tables. Interior
+   nodes are arrays of child pointers, allocated on first use. A leaf
+   is a bitmap of the mapped pages in one huge page. Leaves are threaded
+   on a list so pagemap_for_each never walks the tree. */
 
-static mpage *all_mapped_pages;
+#define PAGEMAP_BITS 9
+#define PAGEMAP_FANOUT (1 << PAGEMAP_BITS)
+#define PAGEMAP_ADDR_BITS 48
+#define PAGEMAP_INDEX(p, level) \
+  ((((uintptr_t)(p)) >> (LOG_APAGE_SIZE + PAGEMAP_BITS * (level))) & (PAGEMAP_FANOUT - 1))
 
-static mpage ***page_maps1;
+#if LOG_APAGE_SIZE + PAGEMAP_BITS != LOG_AHUGE_SIZE
+#error "a pagemap leaf must cover exactly one huge page"
+#endif
 
-#define PAGEMAP64_LEVEL1_SIZE (1 << 16)
-#define PAGEMAP64_LEVEL2_SIZE (1 << 16)
-#define PAGEMAP64_LEVEL3_SIZE (1 << (32 - LOG_APAGE_SIZE))
-#define PAGEMAP64_LEVEL1_BITS(p) (((uintptr_t)(p)) >> 48)
-#define PAGEMAP64_LEVEL2_BITS(p) ((((uintptr_t)(p)) >> 32) & ((PAGEMAP64_LEVEL2_SIZE) - 1))
-#define PAGEMAP64_LEVEL3_BITS(p) ((((uintptr_t)(p)) >> LOG_APAGE_SIZE) & ((PAGEMAP64_LEVEL3_SIZE) - 1))
+typedef struct pm_leaf {
+  uint64_t bits[PAGEMAP_FANOUT / 64]; /* one bit per mapped page */
+  char *base;                         /* address of the first page */
+  struct pm_leaf *next;               /* all leaves ever allocated */
+} pm_leaf;
 
-void pagemap_modify(void *p, int mapped) {
-  uintptr_t pos;
-  mpage **page_maps2;
-  mpage *page_maps3;
-  mpage *page;
+static void **pagemap_root;
+static pm_leaf *all_leaves;
+
+static void *alloc_node(size_t size) {
+  void *node = calloc(1, size);
+  if (!node) {
+    fprintf(stderr, "internal error: out of memory for the pagemap\n");
+    abort();
+  }
+  return node;
+}
+
+/* The leaf covering p, allocating the path to it if create is set */
+static pm_leaf *leaf_of(void *p, int create) {
+  void **node;
+  int level;
 
-  if (!page_maps1) {
-    page_maps1 = calloc(PAGEMAP64_LEVEL1_SIZE, sizeof(mpage **));
+  if (((uintptr_t)p) >> PAGEMAP_ADDR_BITS) {
+    if (!create) return NULL;
+    fprintf(stderr, "internal error: address beyond the pagemap: %p\n", p);
+    abort();
   }
 
-  pos = PAGEMAP64_LEVEL1_BITS(p);
-  page_maps2 = page_maps1[pos];
-  if (!page_maps2) {
-    page_maps2 = calloc(PAGEMAP64_LEVEL2_SIZE, sizeof(mpage *));
-    page_maps1[pos] = page_maps2;
+  if (!pagemap_root) {
+    if (!create) return NULL;
+    pagemap_root = alloc_node(PAGEMAP_FANOUT * sizeof(void *));
   }
-  
-  pos = PAGEMAP64_LEVEL2_BITS(p);
-  page_maps3 = page_maps2[pos];
-  if (!page_maps3) {
-    page_maps3 = calloc(PAGEMAP64_LEVEL3_SIZE, sizeof(mpage));
-    page_maps2[pos] = page_maps3;
+
+  node = pagemap_root;
+  for (level = 3; level > 1; level--) {
+    void **child = node[PAGEMAP_INDEX(p, level)];
+    if (!child) {
+      if (!create) return NULL;
+      child = alloc_node(PAGEMAP_FANOUT * sizeof(void *));
+      node[PAGEMAP_INDEX(p, level)] = child;
+    }
+    node = child;
   }
 
-  page = &page_maps3[PAGEMAP64_LEVEL3_BITS(p)];
+  pm_leaf *leaf = node[PAGEMAP_INDEX(p, 1)];
+  if (!leaf && create) {
+    leaf = alloc_node(sizeof(pm_leaf));
+    leaf->base = (char *)((uintptr_t)p & ~(uintptr_t)(AHUGE_SIZE - 1));
+    leaf->next = all_leaves;
+    all_leaves = leaf;
+    node[PAGEMAP_INDEX(p, 1)] = leaf;
+  }
+  return leaf;
+}
+
+void pagemap_modify(void *p, int mapped) {
+  pm_leaf *leaf = leaf_of(p, 1);
+  uintptr_t i = PAGEMAP_INDEX(p, 0);
+  uint64_t bit = (uint64_t)1 << (i % 64);
 
   if (mapped) {
-    if (page->addr) {
+    if (leaf->bits[i / 64] & bit) {
       fprintf(stderr, "internal error: page is already mapped\n");
       abort();
     }
-    if (page == all_mapped_pages)
-      abort();
-    page->addr = p;
-    page->prev = NULL;
-    page->next = all_mapped_pages;
-    if (all_mapped_pages)
-      all_mapped_pages->prev = page;
-    all_mapped_pages = page;
+    leaf->bits[i / 64] |= bit;
   } else {
-    if (!page->addr) {
+    if (!(leaf->bits[i / 64] & bit)) {
       fprintf(stderr, "internal error: not currently mapped\n");
       abort();
     }
-    page->addr = NULL;
-    if (page->prev)
-      page->prev->next = page->next;
-    else
-      all_mapped_pages = page->next;
-    if (page->next)
-      page->next->prev = page->prev;
+    leaf->bits[i / 64] &= ~bit;
   }
 }
 
 int pagemap_is_mapped(void *p) {
-  mpage **page_maps2;
-  mpage *page_maps3;
-
-  if (!page_maps1) return 0;
-  page_maps2 = page_maps1[PAGEMAP64_LEVEL1_BITS(p)];
-  if (!page_maps2) return 0;
-  page_maps3 = page_maps2[PAGEMAP64_LEVEL2_BITS(p)];
-  if (!page_maps3) return 0;
-  return !!page_maps3[PAGEMAP64_LEVEL3_BITS(p)].addr;
+  pm_leaf *leaf = leaf_of(p, 0);
+  uintptr_t i = PAGEMAP_INDEX(p, 0);
+
+  if (!leaf) return 0;
+  return (leaf->bits[i / 64] >> (i % 64)) & 1;
+}
+
+/* Bits lo..hi-1 of a bitmap word */
+static uint64_t word_mask(int lo, int hi) {
+  uint64_t upto = (hi == 64) ? ~(uint64_t)0 : ((uint64_t)1 << hi) - 1;
+  return upto & ~(((uint64_t)1 << lo) - 1);
+}
+
+/* Call op on each leaf [lo, hi) of pages in [p, p+size) overlaps, with
+   the first and one-past-last page index within that leaf; stop early
+   (returning 0) if op does. */
+static int for_each_leaf(char *p, size_t size, int create,
+                         int (*op)(pm_leaf *leaf, int lo, int hi, void *arg),
+                         void *arg) {
+  char *end = p + size;
+
+  while (p < end) {
+    char *leaf_end = (char *)(((uintptr_t)p | (AHUGE_SIZE - 1)) + 1);
+    int lo = PAGEMAP_INDEX(p, 0);
+    int hi = (end >= leaf_end) ? PAGEMAP_FANOUT
+      : (int)PAGEMAP_INDEX(end - 1, 0) + 1;
+
+    if (!op(leaf_of(p, create), lo, hi, arg))
+      return 0;
+    p = leaf_end;
+  }
+  return 1;
+}
+
+/* Nonzero if every page in lo..hi-1 of leaf is mapped, or if none is
+   when want is 0 */
+static int leaf_all(pm_leaf *leaf, int lo, int hi, int want) {
+  int i;
+
+  if (!leaf) return !want;
+  for (i = lo / 64; i * 64 < hi; i++) {
+    uint64_t m = word_mask(i * 64 > lo ? 0 : lo % 64,
+                           (i + 1) * 64 < hi ? 64 : hi - i * 64);
+    if ((leaf->bits[i] & m) != (want ? m : 0))
+      return 0;
+  }
+  return 1;
+}
+
+static int test_op(pm_leaf *leaf, int lo, int hi, void *arg) {
+  (void)arg;
+  return leaf_all(leaf, lo, hi, 1);
+}
+
+static int modify_op(pm_leaf *leaf, int lo, int hi, void *arg) {
+  int mapped = *(int *)arg;
+  int i;
+
+  if (!leaf_all(leaf, lo, hi, !mapped)) {
+    fprintf(stderr, mapped ? "internal error: page is already mapped\n"
+            : "internal error: not currently mapped\n");
+    abort();
+  }
+  for (i = lo / 64; i * 64 < hi; i++) {
+    uint64_t m = word_mask(i * 64 > lo ? 0 : lo % 64,
+                           (i + 1) * 64 < hi ? 64 : hi - i * 64);
+    if (mapped)
+      leaf->bits[i] |= m;
+    else
+      leaf->bits[i] &= ~m;
+  }
+  return 1;
+}
+
+/* Mark the size bytes of pages at page-aligned p (un)mapped, one tree
+   walk and a few word operations per leaf */
+void pagemap_modify_range(void *p, size_t size, int mapped) {
+  for_each_leaf(p, size, 1, modify_op, &mapped);
+}
+
+/* Nonzero if every page holding a byte of [p, p+size) is mapped */
+int pagemap_is_mapped_range(void *p, size_t size) {
+  char *first = (char *)((uintptr_t)p & ~(uintptr_t)(APAGE_SIZE - 1));
+  return for_each_leaf(first, (char *)p + size - first, 0, test_op, NULL);
 }
 
 void pagemap_for_each(page_callback f) {
-  mpage *p, *next;
-  p = all_mapped_pages;
-  while (p) {
-    next = p->next;
-    f(p->addr);
-    pagemap_modify(p->addr, 0);
-    p = next;
+  pm_leaf *leaf;
+  int i, b;
+
+  for (leaf = all_leaves; leaf; leaf = leaf->next) {
+    for (i = 0; i < PAGEMAP_FANOUT / 64; i++) {
+      while (leaf->bits[i]) {
+        b = __builtin_ctzll(leaf->bits[i]);
+        leaf->bits[i] &= leaf->bits[i] - 1;
+        f(leaf->base + ((size_t)(i * 64 + b) << LOG_APAGE_SIZE), APAGE_SIZE);
+      }
+    }
   }
-  all_mapped_pages = NULL;
 }
@@ -1,10 +1,15 @@
-
-typedef void (*page_callback)(void *addr);
+typedef void (*page_callback)(void *addr, size_t size);
 
 void pagemap_modify(void *addr, int mapped);
+void pagemap_modify_range(void *addr, size_t size, int mapped);
 int pagemap_is_mapped(void *addr);
+int pagemap_is_mapped_range(void *addr, size_t size);
 void pagemap_for_each(page_callback f);
 
 /* APAGE_SIZE needs to match the actual page size */
 #define LOG_APAGE_SIZE 12
 #define APAGE_SIZE (1 << LOG_APAGE_SIZE)
+
+/* A huge page, the span of one pagemap leaf */
+#define LOG_AHUGE_SIZE 21
+#define AHUGE_SIZE (1 << LOG_AHUGE_SIZE)
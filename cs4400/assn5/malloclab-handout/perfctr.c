@@ -0,0 +1,138 @@
+/*
+ * perfctr.c - Count hardware events used by a test function f with
+ *     Linux perf_event_open.
+ *
+ * Each counter is opened on its own rather than as a group, so a
+ * machine without one event (a VM without an LLC event, say) still
+ * reports the rest. Only user-level events of this process are
+ * counted, which perf_event_paranoid allows up to level 2.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#endif
+#include "perfctr.h"
+
+static int fds[PERFCTR_NUM]; /* open counters, or -1 */
+
+static const char *names[PERFCTR_NUM] = {
+    "cycles", "instrs", "L1D-miss", "LLC-miss", "dTLB-miss", "br-miss"
+};
+
+#ifdef __linux__
+
+/* The perf event type and config of each counter */
+#define CACHE_MISS(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | \
+     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct { uint32_t type; uint64_t config; } events[PERFCTR_NUM] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_L1D)},
+    {PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_LL)},
+    {PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_DTLB)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+/*
+ * init_perfctr - Open every counter we can, disabled
+ */
+int init_perfctr(int verbose)
+{
+    struct perf_event_attr attr;
+    int i, n = 0, err = 0;
+
+    for (i = 0; i < PERFCTR_NUM; i++) {
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = events[i].type;
+	attr.config = events[i].config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+	    PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	if (fds[i] < 0)
+	    err = errno;
+	else
+	    n++;
+    }
+
+    if (n == 0 && verbose)
+	printf("Hardware counters unavailable: perf_event_open: %s\n",
+	       strerror(err));
+    return n;
+}
+
+/*
+ * perfctr_count - Count the events of one run of f(argp)
+ */
+void perfctr_count(perfctr_test_funct f, void *argp, double counts[PERFCTR_NUM])
+{
+    uint64_t buf[3]; /* value, time enabled, time running */
+    int i;
+
+    for (i = 0; i < PERFCTR_NUM; i++) {
+	if (fds[i] >= 0) {
+	    ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+	    ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+    }
+
+    f(argp);
+
+    for (i = 0; i < PERFCTR_NUM; i++)
+	if (fds[i] >= 0)
+	    ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+
+    for (i = 0; i < PERFCTR_NUM; i++) {
+	counts[i] = -1;
+	if (fds[i] < 0 || read(fds[i], buf, sizeof(buf)) != sizeof(buf)
+	    || buf[2] == 0)
+	    continue;
+	counts[i] = (double)buf[0];
+	if (buf[2] < buf[1]) /* multiplexed: scale to the whole run */
+	    counts[i] *= (double)buf[1] / buf[2];
+    }
+}
+
+#else
+
+int init_perfctr(int verbose)
+{
+    int i;
+
+    for (i = 0; i < PERFCTR_NUM; i++)
+	fds[i] = -1;
+    if (verbose)
+	printf("Hardware counters unavailable: needs Linux perf_event_open\n");
+    return 0;
+}
+
+void perfctr_count(perfctr_test_funct f, void *argp, double counts[PERFCTR_NUM])
+{
+    int i;
+
+    f(argp);
+    for (i = 0; i < PERFCTR_NUM; i++)
+	counts[i] = -1;
+}
+
+#endif
+
+/*
+ * perfctr_name - Column name of counter i
+ */
+const char *perfctr_name(int i)
+{
+    return names[i];
+}
@@ -0,0 +1,28 @@
+/*
+ * perfctr.h - Hardware performance counters around a test function f
+ */
+
+/* The counters, in the order perfctr_count reports them */
+enum {
+    PERFCTR_CYCLES,
+    PERFCTR_INSTRUCTIONS,
+    PERFCTR_L1D_MISSES,
+    PERFCTR_LLC_MISSES,
+    PERFCTR_DTLB_MISSES,
+    PERFCTR_BRANCH_MISSES,
+    PERFCTR_NUM
+};
+
+typedef void (*perfctr_test_funct)(void *);
+
+/* Open the counters. Return how many could be opened; when none could,
+   a reason is printed if verbose is set */
+int init_perfctr(int verbose);
+
+/* Short column name of counter i */
+const char *perfctr_name(int i);
+
+/* Run f(argp) once with the counters enabled. Store each counter's
+   count, scaled up if the kernel had to multiplex it, in counts[],
+   or -1 for a counter that could not be opened */
+void perfctr_count(perfctr_test_funct f, void *argp, double counts[PERFCTR_NUM]);
@@ -81,6 +81,32 @@ while ($line = <STDIN>) {
     # save the line for output later
     $lines[$requestnum++] = $line;
 
+    # arena scope markers carry an arena id, not a block id
+    if ($cmd eq "b" or $cmd eq "e") {
+	next;
+    }
+
+    # batch requests cover ids $id..$id+$count-1: check each one
+    # as if it were a single alloc or free request
+    if ($cmd eq "A" or $cmd eq "F") {
+	$count = $size;
+	for ($i = $id; $i < $id + $count; $i++) {
+	    if ($cmd eq "A" and exists($HASH{$i})) {
+		die "$0: ERROR[$linenum]: batch allocates live ID $i.\n";
+	    }
+	    if ($cmd eq "F" and $HASH{$i} ne "a" and $HASH{$i} ne "r") {
+		die "$0: ERROR[$linenum]: batch frees unallocated block $i.\n";
+	    }
+	    if ($cmd eq "A") {
+		$HASH{$i} = "a";
+	    }
+	    else {
+		delete $HASH{$i};
+	    }
+	}
+	next;
+    }
+
     #ignore realloc requests, as long as they are preceeded by an alloc request
     if ($cmd eq "r") {
 	if (!$HASH{$id}) {
@@ -0,0 +1,61 @@
+#!/usr/bin/perl
+#!/usr/local/bin/perl
+
+$out_filename = "arena.rep";
+$num_requests = 150;     # arena scopes, one per simulated request
+$min_objects = 50;       # small objects allocated per request...
+$max_objects = 250;      # ... at most
+$max_obj_size = 256;
+$grow_every = 10;        # every nth object is grown once by realloc
+$keep_every = 10;        # every nth request leaves one long-lived block
+srand(4400);
+
+# Open output file
+open OUTFILE, ">$out_filename" or die "Cannot create $out_filename\n";
+
+# Each request opens arena scope 0, fills it with small objects, grows
+# some of them, frees them all, and closes the scope. Now and then a
+# long-lived block is allocated outside any scope.
+@lines = ();
+@kept = ();
+$blk = 0;
+for ($r = 0;  $r < $num_requests; $r += 1) {
+	push @lines, "b 0";
+	$n = $min_objects + int(rand($max_objects - $min_objects + 1));
+	@live = ();
+	for ($i = 0;  $i < $n; $i += 1) {
+		$size = 1 + int(rand $max_obj_size);
+		push @lines, "a $blk $size";
+		if ($i % $grow_every == 0) {
+			$size *= 2;
+			push @lines, "r $blk $size";
+		}
+		push @live, $blk;
+		$blk += 1;
+	}
+	foreach $id (reverse @live) {
+		push @lines, "f $id";
+	}
+	push @lines, "e 0";
+
+	if ($r % $keep_every == 0) {
+		$size = 1 + int(rand(4 * $max_obj_size));
+		push @lines, "a $blk $size";
+		push @kept, $blk;
+		$blk += 1;
+	}
+}
+foreach $id (@kept) {
+	push @lines, "f $id";
+}
+
+$num_ops = scalar @lines;
+print OUTFILE "0\n";
+print OUTFILE "$blk\n";
+print OUTFILE "$num_ops\n";
+print OUTFILE "1\n";
+foreach $line (@lines) {
+	print OUTFILE "$line\n";
+}
+
+close OUTFILE;
@@ -0,0 +1,65 @@
+#!/usr/bin/perl
+#!/usr/local/bin/perl
+
+$out_filename = "batch.rep";
+$num_rounds = 400;       # batches allocated
+$min_batch = 32;         # objects per batch...
+$max_batch = 256;        # ... at most
+@sizes = (72, 96, 128, 200, 320, 512);
+$max_live = 6;           # batches alive at once
+$stray_every = 4;        # a single block allocated every nth round
+srand(4400);
+
+# Open output file
+open OUTFILE, ">$out_filename" or die "Cannot create $out_filename\n";
+
+# Each round allocates a batch of same-sized objects, as a pool or a
+# node array would, with one "A" request. Once max_live batches are
+# alive, a random one of them is released with one "F" request. Single
+# blocks allocated between the batches live for a few rounds and keep
+# the freed batches from merging with everything around them.
+@lines = ();
+@live = ();              # "id count" of each live batch
+@strays = ();
+$blk = 0;
+for ($r = 0;  $r < $num_rounds; $r += 1) {
+	$n = $min_batch + int(rand($max_batch - $min_batch + 1));
+	$size = $sizes[int(rand(scalar @sizes))];
+	push @lines, "A $blk $n $size";
+	push @live, "$blk $n";
+	$blk += $n;
+
+	if ($r % $stray_every == 0) {
+		$size = 1 + int(rand 1024);
+		push @lines, "a $blk $size";
+		push @strays, $blk;
+		$blk += 1;
+		if (scalar @strays > 3) {
+			$id = shift @strays;
+			push @lines, "f $id";
+		}
+	}
+
+	if (scalar @live > $max_live) {
+		$i = int(rand(scalar @live));
+		$batch = splice(@live, $i, 1);
+		push @lines, "F $batch";
+	}
+}
+foreach $batch (@live) {
+	push @lines, "F $batch";
+}
+foreach $id (@strays) {
+	push @lines, "f $id";
+}
+
+$num_ops = scalar @lines;
+print OUTFILE "0\n";
+print OUTFILE "$blk\n";
+print OUTFILE "$num_ops\n";
+print OUTFILE "1\n";
+foreach $line (@lines) {
+	print OUTFILE "$line\n";
+}
+
+close OUTFILE;
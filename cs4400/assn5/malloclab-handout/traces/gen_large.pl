@@ -0,0 +1,47 @@
+#!/usr/bin/perl
+#!/usr/local/bin/perl
+
+$out_filename = "large.rep";
+$num_allocs = 1000;
+$min_size = 64 * 1024;       # every block gets a mapping of its own...
+$max_size = 4 * 1024 * 1024; # ... of up to 4 MiB
+$max_live = 16;              # blocks alive at once
+$grow_every = 4;             # every nth block is grown once by realloc
+srand(4400);
+
+# Open output file
+open OUTFILE, ">$out_filename" or die "Cannot create $out_filename\n";
+
+# Big buffers with log-uniform sizes: allocate, sometimes grow by
+# half, and once max_live blocks are alive free a random one of them.
+@lines = ();
+@live = ();
+for ($blk = 0;  $blk < $num_allocs; $blk += 1) {
+	$size = int($min_size * ($max_size / $min_size) ** rand());
+	push @lines, "a $blk $size";
+	if ($blk % $grow_every == 0) {
+		$size += int($size / 2);
+		push @lines, "r $blk $size";
+	}
+	push @live, $blk;
+
+	if (scalar @live > $max_live) {
+		$i = int(rand(scalar @live));
+		$id = splice(@live, $i, 1);
+		push @lines, "f $id";
+	}
+}
+foreach $id (@live) {
+	push @lines, "f $id";
+}
+
+$num_ops = scalar @lines;
+print OUTFILE "0\n";
+print OUTFILE "$num_allocs\n";
+print OUTFILE "$num_ops\n";
+print OUTFILE "1\n";
+foreach $line (@lines) {
+	print OUTFILE "$line\n";
+}
+
+close OUTFILE;